@@ -83,6 +83,7 @@
 
 #ifndef __ASSEMBLY__
 extern void __init l2x0_init(void __iomem *base, __u32 aux_val, __u32 aux_mask);
+extern u32 l2x0_get_size(void);
 #endif
 
 #endif
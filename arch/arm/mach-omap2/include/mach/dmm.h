@@ -138,6 +138,18 @@ struct dmm *dmm_pat_init(u32 id);
  */
 s32 dmm_pat_refill(struct dmm *dmm, struct pat *desc, enum pat_mode mode);
 
+/**
+ * Program the physical address translator with a chain of descriptors,
+ * waiting only for the last one to complete.
+ * @param dmm      Device data
+ * @param desc_pa  physical address of the first PAT descriptor.  Descriptors
+ *		   must be 16-byte aligned in coherent memory, and their next
+ *		   field must hold the physical address of the next descriptor
+ *		   (NULL for the last one).
+ * @return an error status.
+ */
+s32 dmm_pat_refill_chain(struct dmm *dmm, u32 desc_pa);
+
 /**
  * Clean up the physical address translator.
  * @param dmm    Device data
@@ -103,6 +103,14 @@ static inline u32 tiler_size(const struct tiler_block_t *b)
 
 /* Event types */
 #define TILER_DEVICE_CLOSE	0
+#define TILER_BLOCK_MOVED	1	/* data is struct tiler_block_moved */
+
+/* a movable block was moved to undo container fragmentation */
+struct tiler_block_moved {
+	struct mem_info *block;	/* block handle */
+	u32 old_ssptr;		/* previous system space address */
+	u32 new_ssptr;		/* current system space address */
+};
 
 /**
  * Registers a notifier block with TILER driver.
@@ -245,6 +253,56 @@ s32 tiler_mapx(struct tiler_block_t *blk, enum tiler_fmt fmt,
  */
 void tiler_free(struct tiler_block_t *blk);
 
+/**
+ * Allocates a 1D or 2D TILER block like tiler_allocx, but first tries to reuse
+ * a block of the same format, size, key and group that the process returned
+ * with tiler_pool_freex.  A reused block keeps its address, pages and
+ * contents.
+ *
+ * @param blk	pointer to tiler block data.  This must be set up ('phys' member
+ *		must be 0) with the tiler block information. 'height' must be 1
+ *		for 1D block.
+ * @param fmt	TILER block format
+ * @param gid	group ID
+ * @param pid	process ID
+ *
+ * @return error status
+ */
+s32 tiler_pool_allocx(struct tiler_block_t *blk, enum tiler_fmt fmt,
+						u32 gid, pid_t pid);
+
+/**
+ * Allocates a TILER block for the current process with group ID 0, reusing a
+ * pooled block if possible.  See tiler_pool_allocx.
+ *
+ * @param blk	pointer to tiler block data
+ * @param fmt	TILER block format
+ *
+ * @return error status
+ */
+s32 tiler_pool_alloc(struct tiler_block_t *blk, enum tiler_fmt fmt);
+
+/**
+ * Returns a TILER block allocated for a process and group to the pool of the
+ * process instead of freeing it.  Pooled blocks that are not reused within the
+ * 'pool_age' module parameter, or when memory is low, are freed.
+ *
+ * @param blk	pointer to a tiler block data as filled by tiler_pool_allocx or
+ *		tiler_allocx.  'phys' and 'id' members will be set to 0 on
+ *		success.
+ * @param gid	group ID the block was allocated for
+ * @param pid	process ID the block was allocated for
+ */
+void tiler_pool_freex(struct tiler_block_t *blk, u32 gid, pid_t pid);
+
+/**
+ * Returns a TILER block allocated for the current process with group ID 0 to
+ * its pool.  See tiler_pool_freex.
+ *
+ * @param blk	pointer to a tiler block data
+ */
+void tiler_pool_free(struct tiler_block_t *blk);
+
 /**
  * Reserves tiler area for n identical blocks for the current process.  Use this
  * method to get optimal placement of multiple identical tiler blocks; however,
@@ -460,6 +518,24 @@ s32 tiler_pin_block(tiler_blk_handle handle, u32 *addr_array, u32 nents);
  */
 void tiler_unpin_block(tiler_blk_handle handle);
 
+/**
+ * Allows or prevents moving a block within the Tiler container.
+ *
+ * When the container becomes too fragmented to satisfy an allocation, the
+ * Tiler driver moves movable blocks that are not referenced by anyone but their
+ * owner.  The pinned pages move with the block, but its system space address
+ * changes, and a TILER_BLOCK_MOVED event is sent to the registered notifiers.
+ * The event is sent with the Tiler block lock held, so the notifier must not
+ * call back into the Tiler driver.
+ *
+ * The owner must not make a block movable while the old address is in use,
+ * e.g. by hardware or in a mapping.
+ *
+ * @param handle	Handle to tiler block information
+ * @param movable	Whether the block may be moved
+ */
+void tiler_set_block_movable(tiler_blk_handle handle, bool movable);
+
 /**
  * Gives memory requirements for a given container allocation
  *
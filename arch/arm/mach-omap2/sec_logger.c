@@ -16,8 +16,8 @@
 #include <linux/init.h>
 #include <linux/kallsyms.h>
 #include <linux/kernel.h>
-#include <linux/miscdevice.h>
 #include <linux/rtc.h>
+#include <linux/spinlock.h>
 
 #include "../../../drivers/staging/android/logger.h"
 
@@ -98,31 +98,34 @@ static int filter_log(const char *log_name, char pri, int min_pri)
 	return 0;
 }
 
-/* simplified(?) version of logger_log */
-struct sec_logger_log {
-	unsigned char *buffer;
-	struct miscdevice misc;
-};
-
+/* logger writers run concurrently on all cpus; this protects logger_buf */
+static DEFINE_SPINLOCK(logger_buf_lock);
 static char logger_buf[1024];
 
-int sec_logger_add_log_ram_console(void *logp, size_t orig)
+int sec_logger_add_log_ram_console(const char *log_name,
+				   const struct logger_entry *entry,
+				   const char *msg)
 {
-	struct logger_entry *entry;
 	struct rtc_time tm;
 	char time[32];
-	char pri, *tag, *message;
-	struct sec_logger_log *log = (struct sec_logger_log *)logp;
+	char pri;
+	const char *tag, *message;
+	int tag_len, len;
 
 	if (likely(!sec_platform_log_en))
 		return 0;
 
-	entry = (struct logger_entry *)(log->buffer + orig);
-	pri = entry->msg[0];
-	tag = entry->msg + 1;
-	message = tag + strlen(tag) + 1;
-
-	if (filter_log(log->misc.name, pri, sec_logger_level) < 0)
+	/* the payload is not necessarily terminated */
+	if (entry->len < 2)
+		return -EINVAL;
+	pri = msg[0];
+	tag = msg + 1;
+	tag_len = strnlen(tag, entry->len - 1);
+	message = tag + tag_len + 1;
+	len = tag_len + 1 < entry->len - 1 ?
+		strnlen(message, entry->len - 2 - tag_len) : 0;
+
+	if (filter_log(log_name, pri, sec_logger_level) < 0)
 		/* printable minimum level */
 		return -EPERM;
 
@@ -131,13 +134,16 @@ int sec_logger_add_log_ram_console(void *logp, size_t orig)
 		 tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
 		 tm.tm_min, tm.tm_sec, entry->nsec / 1000000);
 
-	snprintf(logger_buf, sizeof(logger_buf) - 1, "%s %5d %5d %c %-8s: %s",
-		 time, entry->pid, entry->tid, pri_to_char(pri), tag, message);
+	spin_lock(&logger_buf_lock);
+	snprintf(logger_buf, sizeof(logger_buf) - 1,
+		 "%s %5d %5d %c %-8.*s: %.*s", time, entry->pid, entry->tid, pri_to_char(pri),
+		 tag_len, tag, len, message);
 	if (logger_buf[strlen(logger_buf) - 1] != '\n')
 		/* add a line-feed if needed */
 		strcat(logger_buf, "\n");
 
 	sec_ram_console_write_ext(NULL, logger_buf, strlen(logger_buf));
+	spin_unlock(&logger_buf_lock);
 
 	return 0;
 }
@@ -193,37 +199,15 @@ static void __init sec_logger_ram_console_init(void)
 
 #endif /* CONFIG_SAMSUNG_PRINT_PLATFORM_LOG */
 
-static char sec_klog_buf[256];
-
-void sec_logger_update_buffer(const char *log_str, int count)
+/* echo "!@" marked platform messages to the kernel log */
+void sec_logger_print_message(const char *log_str, int count)
 {
-	const int maxlen = ARRAY_SIZE(sec_klog_buf) - 1;
-	int len;
-
-	sec_klog_buf[0] = '\0';
-
-	if (unlikely(*(u16 *)"!@" == *(u16 *)log_str)) {
-		len = count < maxlen ? count : maxlen;
-		memcpy(sec_klog_buf, log_str, len);
-		sec_klog_buf[len] = '\0';
-	}
-}
-
-void sec_logger_print_buffer(void)
-{
-	if (sec_klog_buf[0])
-		pr_info("%s\n", sec_klog_buf);
-}
-
-static void __init sec_logger_message_init(void)
-{
-	sec_klog_buf[0] = '\0';
+	if (unlikely(count >= 2 && *(u16 *)"!@" == *(u16 *)log_str))
+		pr_info("%.*s\n", min(count, 255), log_str);
 }
 
 static int __init sec_logger_init(void)
 {
-	sec_logger_message_init();
-
 	if (sec_debug_get_level())
 		sec_logger_ram_console_init();
 
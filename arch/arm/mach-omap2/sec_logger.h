@@ -17,21 +17,22 @@
 
 #if defined(CONFIG_SAMSUNG_USE_LOGGER_ADDON)
 
+struct logger_entry;
+
 #if defined(CONFIG_SAMSUNG_PRINT_PLATFORM_LOG)
-extern int sec_logger_add_log_ram_console(void *logp, size_t orig);
+extern int sec_logger_add_log_ram_console(const char *log_name,
+					  const struct logger_entry *entry,
+					  const char *msg);
 #else
-#define sec_logger_add_log_ram_console(logp, orig)
+#define sec_logger_add_log_ram_console(log_name, entry, msg)
 #endif /* CONFIG_SAMSUNG_PRINT_PLATFORM_LOG */
 
-extern void sec_logger_update_buffer(const char *log_str, int count);
-
-extern void sec_logger_print_buffer(void);
+extern void sec_logger_print_message(const char *log_str, int count);
 
 #else /* CONFIG_SAMSUNG_USE_LOGGER_ADDON */
 
-#define sec_logger_add_log_ram_console(logp, orig)
-#define sec_logger_update_buffer(log_str, count)
-#define sec_logger_print_buffer()
+#define sec_logger_add_log_ram_console(log_name, entry, msg)
+#define sec_logger_print_message(log_str, count)
 
 #endif /* CONFIG_SAMSUNG_USE_LOGGER_ADDON */
 
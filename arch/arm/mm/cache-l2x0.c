@@ -320,6 +320,15 @@ static void l2x0_disable(void)
 	spin_unlock_irqrestore(&l2x0_lock, flags);
 }
 
+/*
+ * Size of the cache in bytes, zero before l2x0_init().  Range operations at
+ * least this large are done on the whole cache instead.
+ */
+u32 l2x0_get_size(void)
+{
+	return l2x0_size;
+}
+
 void __init l2x0_init(void __iomem *base, __u32 aux_val, __u32 aux_mask)
 {
 	__u32 aux;
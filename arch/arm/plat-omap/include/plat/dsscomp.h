@@ -1,6 +1,7 @@
 #ifndef _ARCH_ARM_PLAT_OMAP_DSSCOMP_H
 #define _ARCH_ARM_PLAT_OMAP_DSSCOMP_H
 
+#include <linux/ktime.h>
 #include <video/omapdss.h>
 #include <video/dsscomp.h>
 
@@ -20,6 +21,7 @@ int dsscomp_get_mgr(dsscomp_t comp, struct dss2_mgr_info *mgr);
 int dsscomp_setup(dsscomp_t comp, enum dsscomp_setup_mode mode,
 			struct dss2_rect_t win);
 int dsscomp_delayed_apply(dsscomp_t comp);
+int dsscomp_queue_apply(dsscomp_t comp, ktime_t target);
 void dsscomp_drop(dsscomp_t c);
 
 struct tiler_pa_info;
@@ -15,6 +15,7 @@
  */
 
 #include <linux/device.h>
+#include <linux/dma-mapping.h>
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/anon_inodes.h>
@@ -30,6 +31,12 @@
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
 
+#include <asm/cacheflush.h>
+#include <asm/outercache.h>
+#ifdef CONFIG_CACHE_L2X0
+#include <asm/hardware/cache-l2x0.h>
+#endif
+
 #include "ion_priv.h"
 #include "../pvr/ion.h"
 #define DEBUG
@@ -953,6 +960,164 @@ static int ion_inval_cached(struct ion_handle *handle, size_t size,
 	return 0;
 }
 
+void ion_outer_cache_range(ion_phys_addr_t start, size_t len,
+			   enum cache_operation op)
+{
+	switch (op) {
+	case CACHE_CLEAN:
+		outer_clean_range(start, start + len);
+		break;
+	case CACHE_INVALIDATE:
+		outer_inv_range(start, start + len);
+		break;
+	case CACHE_FLUSH:
+		outer_flush_range(start, start + len);
+		break;
+	}
+}
+
+static void ion_flush_cache_all_cpu(void *arg)
+{
+	flush_cache_all();
+}
+
+static size_t ion_outer_cache_size(void)
+{
+#ifdef CONFIG_CACHE_L2X0
+	return l2x0_get_size();
+#else
+	return 0;
+#endif
+}
+
+/* maintains the cpu caches for a range of the current process's memory */
+static void ion_inner_cache_range(unsigned long start, size_t len,
+				  enum cache_operation op)
+{
+	switch (op) {
+	case CACHE_CLEAN:
+		dmac_map_area((void *)start, len, DMA_TO_DEVICE);
+		break;
+	case CACHE_INVALIDATE:
+		dmac_unmap_area((void *)start, len, DMA_FROM_DEVICE);
+		break;
+	case CACHE_FLUSH:
+		dmac_flush_range((void *)start, (void *)(start + len));
+		break;
+	}
+}
+
+/*
+ * ion_cache_op_valid - check that the range of a cache operation is mapped
+ * from its buffer, at the offset given, in the caller's address space.
+ *
+ * Caller needs to hold mmap_sem.
+ */
+static bool ion_cache_op_valid(struct ion_cache_op_data *op)
+{
+	struct ion_buffer *buffer = op->handle->buffer;
+	unsigned long start = op->vaddr + op->offset;
+	struct vm_area_struct *vma;
+
+	if (start < op->vaddr || start + op->len < start)
+		return false;
+	vma = find_vma(current->mm, start);
+	if (!vma || vma->vm_start > start || start + op->len > vma->vm_end)
+		return false;
+	if (vma->vm_ops != &ion_vm_ops || !vma->vm_file ||
+	    vma->vm_file->private_data != buffer)
+		return false;
+
+	return (start - vma->vm_start) + (vma->vm_pgoff << PAGE_SHIFT) ==
+		op->offset;
+}
+
+/*
+ * ion_cache_ops - do a vector of cache operations from ION_IOC_CACHE_OPS.
+ * Every range is checked first, then the cpu caches and the outer cache are
+ * each either maintained range by range or, once the ranges add up to more
+ * than a line by line walk is worth, flushed whole a single time.
+ *
+ * Cleans and flushes go inner then outer, so that dirty lines reach memory;
+ * invalidates go outer then inner, so that the cpu cannot refill a line
+ * from a stale outer cache.
+ */
+static int ion_cache_ops(struct ion_client *client,
+			 struct ion_cache_op_data *ops, unsigned int count)
+{
+	struct ion_buffer *buffer;
+	size_t outer_size = ion_outer_cache_size();
+	size_t total = 0;
+	bool inner_all, outer_all, inval = false;
+	unsigned int i;
+	int ret = 0;
+
+	/* mmap_sem nests outside client->lock, as in ion_share_mmap() */
+	down_read(&current->mm->mmap_sem);
+	mutex_lock(&client->lock);
+	for (i = 0; i < count; i++) {
+		if (!ion_handle_validate(client, ops[i].handle)) {
+			pr_err("%s: invalid handle passed to cache ops ioctl.\n",
+			       __func__);
+			ret = -EINVAL;
+			goto out;
+		}
+		buffer = ops[i].handle->buffer;
+		if (!buffer->heap->ops->outer_range || !buffer->map_cacheable ||
+		    ops[i].op > CACHE_FLUSH || ops[i].offset > buffer->size ||
+		    ops[i].len > buffer->size - ops[i].offset ||
+		    !ion_cache_op_valid(&ops[i])) {
+			ret = -EINVAL;
+			goto out;
+		}
+		if (ops[i].op == CACHE_INVALIDATE)
+			inval = true;
+		total += ops[i].len;
+	}
+
+	inner_all = total > FULL_CACHE_FLUSH_THRESHOLD;
+	outer_all = outer_size && total >= outer_size;
+
+	/* write dirty lines back from the cpu caches */
+	if (inner_all)
+		on_each_cpu(ion_flush_cache_all_cpu, NULL, 1);
+	else
+		for (i = 0; i < count; i++)
+			if (ops[i].op != CACHE_INVALIDATE)
+				ion_inner_cache_range(ops[i].vaddr +
+						      ops[i].offset,
+						      ops[i].len, ops[i].op);
+
+	if (outer_all) {
+		outer_flush_all();
+	} else {
+		for (i = 0; i < count; i++) {
+			buffer = ops[i].handle->buffer;
+			mutex_lock(&buffer->lock);
+			ret = buffer->heap->ops->outer_range(buffer,
+						ops[i].offset, ops[i].len,
+						ops[i].op);
+			mutex_unlock(&buffer->lock);
+			if (ret)
+				goto out;
+		}
+	}
+
+	/* then drop what the cpu caches hold of what the device wrote */
+	if (inval && inner_all)
+		on_each_cpu(ion_flush_cache_all_cpu, NULL, 1);
+	else if (inval)
+		for (i = 0; i < count; i++)
+			if (ops[i].op == CACHE_INVALIDATE)
+				ion_inner_cache_range(ops[i].vaddr +
+						      ops[i].offset,
+						      ops[i].len, ops[i].op);
+out:
+	mutex_unlock(&client->lock);
+	up_read(&current->mm->mmap_sem);
+	return ret;
+}
+
 static int ion_map_gralloc(struct ion_client *client, void *grallocHandle,
 			   struct ion_handle **handleY)
 {
@@ -1160,6 +1325,28 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		break;
 	}
 
+	case ION_IOC_CACHE_OPS:
+	{
+		struct ion_cache_ops_data data;
+		struct ion_cache_op_data *ops;
+		int ret;
+
+		if (copy_from_user(&data, (void __user *)arg, sizeof(data)))
+			return -EFAULT;
+		if (!data.count || data.count > ION_CACHE_OPS_MAX)
+			return -EINVAL;
+		ops = kmalloc(data.count * sizeof(*ops), GFP_KERNEL);
+		if (!ops)
+			return -ENOMEM;
+		if (copy_from_user(ops, (void __user *)data.ops,
+				   data.count * sizeof(*ops)))
+			ret = -EFAULT;
+		else
+			ret = ion_cache_ops(client, ops, data.count);
+		kfree(ops);
+		return ret;
+	}
+
 	default:
 		return -ENOTTY;
 	}
@@ -17,9 +17,11 @@
 
 #include <linux/err.h>
 #include <linux/genalloc.h>
+#include <linux/highmem.h>
 #include <linux/io.h>
 #include <linux/ion.h>
 #include <linux/mm.h>
+#include <linux/mutex.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
@@ -28,12 +30,98 @@
 #include <asm/mach/map.h>
 #include <asm/cacheflush.h>
 
+/*
+ * A movable carveout is handed to the page allocator as MIGRATE_CMA
+ * pageblocks at creation.  The pool still decides where a buffer goes, and
+ * alloc_contig_range() then migrates out whatever borrowed that range.
+ */
 struct ion_carveout_heap {
 	struct ion_heap heap;
 	struct gen_pool *pool;
 	ion_phys_addr_t base;
+	bool movable;
+	struct mutex contig_lock;
 };
 
+#ifdef CONFIG_CMA
+static int ion_carveout_claim(struct ion_carveout_heap *carveout_heap,
+			      ion_phys_addr_t addr, unsigned long size)
+{
+	unsigned long pfn = __phys_to_pfn(addr);
+	unsigned long nr_pages = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	unsigned long i;
+	int ret;
+
+	mutex_lock(&carveout_heap->contig_lock);
+	ret = alloc_contig_range(pfn, pfn + nr_pages);
+	mutex_unlock(&carveout_heap->contig_lock);
+	if (ret)
+		return ret;
+
+	/*
+	 * The pages held someone else's data a moment ago.  Zero them and
+	 * write the zeroes back, so that no dirty line from the cacheable
+	 * kernel mapping is later evicted over data written by a device or
+	 * through an uncached user mapping.
+	 */
+	for (i = 0; i < nr_pages; i++) {
+		void *va = kmap_atomic(pfn_to_page(pfn + i), KM_USER0);
+
+		memset(va, 0, PAGE_SIZE);
+		dmac_flush_range(va, va + PAGE_SIZE);
+		kunmap_atomic(va, KM_USER0);
+	}
+	outer_flush_range(addr, addr + (nr_pages << PAGE_SHIFT));
+	return 0;
+}
+
+static void ion_carveout_release(ion_phys_addr_t addr, unsigned long size)
+{
+	free_contig_range(__phys_to_pfn(addr), PAGE_ALIGN(size) >> PAGE_SHIFT);
+}
+
+static bool ion_carveout_lend(struct ion_platform_heap *heap_data)
+{
+	unsigned long pfn = __phys_to_pfn(heap_data->base);
+	unsigned long end = pfn + (heap_data->size >> PAGE_SHIFT);
+	struct zone *zone;
+
+	if (!IS_ALIGNED(pfn | end, pageblock_nr_pages) ||
+	    !pfn_valid(pfn) || !pfn_valid(end - 1)) {
+		pr_err("%s: %s is not pageblock aligned memory, not lending it\n",
+		       __func__, heap_data->name);
+		return false;
+	}
+	zone = page_zone(pfn_to_page(pfn));
+	if (page_zone(pfn_to_page(end - 1)) != zone) {
+		pr_err("%s: %s spans zones, not lending it\n", __func__,
+		       heap_data->name);
+		return false;
+	}
+
+	for (; pfn < end; pfn += pageblock_nr_pages)
+		init_cma_reserved_pageblock(pfn_to_page(pfn));
+	return true;
+}
+#else
+static int ion_carveout_claim(struct ion_carveout_heap *carveout_heap,
+			      ion_phys_addr_t addr, unsigned long size)
+{
+	return 0;
+}
+
+static void ion_carveout_release(ion_phys_addr_t addr, unsigned long size)
+{
+}
+
+static bool ion_carveout_lend(struct ion_platform_heap *heap_data)
+{
+	pr_err("%s: %s can only be lent with CONFIG_CMA\n", __func__,
+	       heap_data->name);
+	return false;
+}
+#endif
+
 ion_phys_addr_t ion_carveout_allocate(struct ion_heap *heap,
 				      unsigned long size,
 				      unsigned long align)
@@ -45,6 +133,12 @@ ion_phys_addr_t ion_carveout_allocate(struct ion_heap *heap,
 	if (!offset)
 		return ION_CARVEOUT_ALLOCATE_FAIL;
 
+	if (carveout_heap->movable &&
+	    ion_carveout_claim(carveout_heap, offset, size)) {
+		gen_pool_free(carveout_heap->pool, offset, size);
+		return ION_CARVEOUT_ALLOCATE_FAIL;
+	}
+
 	return offset;
 }
 
@@ -56,6 +150,8 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 
 	if (addr == ION_CARVEOUT_ALLOCATE_FAIL)
 		return;
+	if (carveout_heap->movable)
+		ion_carveout_release(addr, size);
 	gen_pool_free(carveout_heap->pool, addr, size);
 }
 
@@ -97,17 +193,57 @@ void ion_carveout_heap_unmap_dma(struct ion_heap *heap,
 	return;
 }
 
+/*
+ * Write back and drop the cached lines of a cacheable kernel mapping of a
+ * buffer, so that neither the cpu nor a device sees stale data once it
+ * is mapped or after it is unmapped.
+ */
+static void ion_carveout_flush_kernel(struct ion_buffer *buffer, void *vaddr)
+{
+	dmac_flush_range(vaddr, vaddr + buffer->size);
+	outer_flush_range(buffer->priv_phys, buffer->priv_phys + buffer->size);
+}
+
 void *ion_carveout_heap_map_kernel(struct ion_heap *heap,
 				   struct ion_buffer *buffer)
 {
-	return __arch_ioremap(buffer->priv_phys, buffer->size,
-			      MT_MEMORY_NONCACHED);
+	int n_pages = PAGE_ALIGN(buffer->size) >> PAGE_SHIFT;
+	unsigned long pfn = __phys_to_pfn(buffer->priv_phys);
+	struct page **pages;
+	void *vaddr;
+	int i;
+
+	if (!pfn_valid(pfn))
+		return __arch_ioremap(buffer->priv_phys, buffer->size,
+				      MT_MEMORY_NONCACHED);
+
+	/*
+	 * A movable carveout is ordinary ram, which ioremap refuses.  It is
+	 * also mapped cacheable by the linear map, and ARM forbids mapping
+	 * the same memory with different attributes, so it is mapped
+	 * cacheable here too and the caches are maintained by hand.
+	 */
+	pages = vmalloc(n_pages * sizeof(struct page *));
+	if (!pages)
+		return NULL;
+	for (i = 0; i < n_pages; i++)
+		pages[i] = pfn_to_page(pfn + i);
+	vaddr = vmap(pages, n_pages, VM_MAP, PAGE_KERNEL);
+	vfree(pages);
+	if (vaddr)
+		ion_carveout_flush_kernel(buffer, vaddr);
+	return vaddr;
 }
 
 void ion_carveout_heap_unmap_kernel(struct ion_heap *heap,
 				    struct ion_buffer *buffer)
 {
-	__arch_iounmap(buffer->vaddr);
+	if (pfn_valid(__phys_to_pfn(buffer->priv_phys))) {
+		ion_carveout_flush_kernel(buffer, buffer->vaddr);
+		vunmap(buffer->vaddr);
+	} else {
+		__arch_iounmap(buffer->vaddr);
+	}
 	buffer->vaddr = NULL;
 	return;
 }
@@ -165,6 +301,15 @@ int ion_carveout_heap_inval_user(struct ion_buffer *buffer, size_t len,
 	return ion_carveout_heap_cache_operation(buffer, len,
 			vaddr, CACHE_INVALIDATE);
 }
+
+static int ion_carveout_heap_outer_range(struct ion_buffer *buffer,
+					 size_t offset, size_t len,
+					 enum cache_operation op)
+{
+	ion_outer_cache_range(buffer->priv_phys + offset, len, op);
+	return 0;
+}
+
 static struct ion_heap_ops carveout_heap_ops = {
 	.allocate = ion_carveout_heap_allocate,
 	.free = ion_carveout_heap_free,
@@ -172,6 +317,7 @@ static struct ion_heap_ops carveout_heap_ops = {
 	.map_user = ion_carveout_heap_map_user,
 	.flush_user = ion_carveout_heap_flush_user,
 	.inval_user = ion_carveout_heap_inval_user,
+	.outer_range = ion_carveout_heap_outer_range,
 	.map_kernel = ion_carveout_heap_map_kernel,
 	.unmap_kernel = ion_carveout_heap_unmap_kernel,
 };
@@ -192,6 +338,9 @@ struct ion_heap *ion_carveout_heap_create(struct ion_platform_heap *heap_data)
 	carveout_heap->base = heap_data->base;
 	gen_pool_add(carveout_heap->pool, carveout_heap->base, heap_data->size,
 		     -1);
+	mutex_init(&carveout_heap->contig_lock);
+	if (heap_data->movable)
+		carveout_heap->movable = ion_carveout_lend(heap_data);
 	carveout_heap->heap.ops = &carveout_heap_ops;
 	carveout_heap->heap.type = ION_HEAP_TYPE_CARVEOUT;
 
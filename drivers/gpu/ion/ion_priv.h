@@ -146,6 +146,19 @@ struct ion_buffer {
 	bool map_cacheable;
 };
 
+/**
+ * Flushing entire cache is more efficient than flushing virtual address
+ * range of a buffer whose size is 200Kbytes or higher, since line by
+ * line operations of huge buffers consume lot of cpu cycles
+ */
+#define FULL_CACHE_FLUSH_THRESHOLD 200000
+
+enum cache_operation {
+	CACHE_CLEAN		= ION_CACHE_CLEAN,
+	CACHE_INVALIDATE	= ION_CACHE_INVALIDATE,
+	CACHE_FLUSH		= ION_CACHE_FLUSH,
+};
+
 /**
  * struct ion_heap_ops - ops to operate on a given heap
  * @allocate:		allocate memory
@@ -159,6 +172,8 @@ struct ion_buffer {
  * @map_user		map memory to userspace
  * @flush_user		flush memory if mapped as cacheable
  * @inval_user		invalidate memory if mapped as cacheable
+ * @outer_range		maintain the outer cache for a range of a buffer
+ *			mapped as cacheable, see ion_outer_cache_range()
  */
 struct ion_heap_ops {
 	int (*allocate) (struct ion_heap *heap,
@@ -178,6 +193,8 @@ struct ion_heap_ops {
 			unsigned long vaddr);
 	int (*inval_user) (struct ion_buffer *buffer, size_t len,
 			unsigned long vaddr);
+	int (*outer_range) (struct ion_buffer *buffer, size_t offset,
+			    size_t len, enum cache_operation op);
 };
 
 /**
@@ -261,16 +278,13 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 #define ION_CARVEOUT_ALLOCATE_FAIL -1
 
 /**
- * Flushing entire cache is more efficient than flushing virtual address
- * range of a buffer whose size is 200Kbytes or higher, since line by
- * line operations of huge buffers consume lot of cpu cycles
+ * ion_outer_cache_range - clean, invalidate or flush physical memory in the
+ * outer cache
+ * @start:	physical start address
+ * @len:	length in bytes
+ * @op:		the maintenance to do
  */
-#define FULL_CACHE_FLUSH_THRESHOLD 200000
-
-enum cache_operation {
-	CACHE_CLEAN		= 0x0,
-	CACHE_INVALIDATE	= 0x1,
-	CACHE_FLUSH		= 0x2,
-};
+void ion_outer_cache_range(ion_phys_addr_t start, size_t len,
+			   enum cache_operation op);
 
 #endif /* _ION_PRIV_H */
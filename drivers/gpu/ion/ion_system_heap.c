@@ -15,40 +15,206 @@
  */
 
 #include <linux/err.h>
+#include <linux/highmem.h>
 #include <linux/ion.h>
 #include <linux/mm.h>
 #include <linux/scatterlist.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include "ion_priv.h"
 
+/*
+ * Buffers are built from split high-order chunks taken from per-heap pools
+ * of zeroed pages.  The order of each chunk is kept in page_private() of its
+ * first page, so a buffer's page list is all that is needed to give the
+ * chunks back.  Freed chunks are queued on free_list, through page->lru of
+ * their first page, and zeroed and returned to their pool by free_work.
+ */
+static const unsigned int orders[] = {8, 4, 0};
+#define NUM_ORDERS ARRAY_SIZE(orders)
+
+struct ion_page_pool {
+	spinlock_t lock;
+	struct list_head items;
+	int count;
+	gfp_t gfp_mask;
+	unsigned int order;
+};
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool pools[NUM_ORDERS];
+	spinlock_t free_lock;
+	struct list_head free_list;
+	struct work_struct free_work;
+	struct shrinker shrinker;
+};
+
+static const gfp_t low_order_gfp_flags = GFP_KERNEL | __GFP_HIGHMEM |
+					 __GFP_ZERO;
+static const gfp_t high_order_gfp_flags = (GFP_KERNEL | __GFP_HIGHMEM |
+					   __GFP_ZERO | __GFP_NOWARN |
+					   __GFP_NORETRY) & ~__GFP_WAIT;
+
+static struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (pool->count) {
+		page = list_first_entry(&pool->items, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+	}
+	spin_unlock(&pool->lock);
+	if (page)
+		return page;
+
+	page = alloc_pages(pool->gfp_mask, pool->order);
+	if (!page)
+		return NULL;
+	if (pool->order)
+		split_page(page, pool->order);
+	set_page_private(page, pool->order);
+	return page;
+}
+
+/* @page and the pages following it must already be zeroed */
+static void ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&pool->lock);
+	list_add(&page->lru, &pool->items);
+	pool->count++;
+	spin_unlock(&pool->lock);
+}
+
+static int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	struct page *page;
+	int freed = 0;
+	int i;
+
+	while (freed < nr_to_scan) {
+		spin_lock(&pool->lock);
+		if (!pool->count) {
+			spin_unlock(&pool->lock);
+			break;
+		}
+		page = list_entry(pool->items.prev, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+		spin_unlock(&pool->lock);
+
+		set_page_private(page, 0);
+		for (i = 0; i < (1 << pool->order); i++)
+			__free_page(page + i);
+		freed += 1 << pool->order;
+	}
+	return freed;
+}
+
+static int ion_system_heap_pool_pages(struct ion_system_heap *sys_heap)
+{
+	int i, nr_pages = 0;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		nr_pages += sys_heap->pools[i].count << orders[i];
+	return nr_pages;
+}
+
+static int order_to_index(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (order == orders[i])
+			return i;
+	BUG();
+	return -1;
+}
+
+static void ion_system_heap_free_work(struct work_struct *work)
+{
+	struct ion_system_heap *sys_heap =
+		container_of(work, struct ion_system_heap, free_work);
+	struct page *page;
+	unsigned int order;
+	int i;
+
+	spin_lock(&sys_heap->free_lock);
+	while (!list_empty(&sys_heap->free_list)) {
+		page = list_first_entry(&sys_heap->free_list, struct page, lru);
+		list_del(&page->lru);
+		spin_unlock(&sys_heap->free_lock);
+
+		order = page_private(page);
+		for (i = 0; i < (1 << order); i++)
+			clear_highpage(page + i);
+		ion_page_pool_add(&sys_heap->pools[order_to_index(order)],
+				  page);
+		cond_resched();
+
+		spin_lock(&sys_heap->free_lock);
+	}
+	spin_unlock(&sys_heap->free_lock);
+}
+
+static int ion_system_heap_shrink(struct shrinker *shrinker,
+				  struct shrink_control *sc)
+{
+	struct ion_system_heap *sys_heap =
+		container_of(shrinker, struct ion_system_heap, shrinker);
+	int nr_to_scan = sc->nr_to_scan;
+	int i;
+
+	/* cheapest to refill first */
+	for (i = NUM_ORDERS - 1; i >= 0 && nr_to_scan > 0; i--)
+		nr_to_scan -= ion_page_pool_shrink(&sys_heap->pools[i],
+						   nr_to_scan);
+
+	return ion_system_heap_pool_pages(sys_heap);
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    unsigned long size, unsigned long align,
 				    unsigned long flags)
 {
+	struct ion_system_heap *sys_heap =
+		container_of(heap, struct ion_system_heap, heap);
 	int n_pages = PAGE_ALIGN(size) / PAGE_SIZE;
 	struct page **page_list;
-	const int gfp_mask = GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO;
-	int i = 0;
+	struct page *page;
+	int i = 0, j, k;
 
 	page_list = kmalloc(n_pages * sizeof(void *), GFP_KERNEL);
+	if (!page_list)
+		return -ENOMEM;
 
-	for (i = 0; i < n_pages; i++) {
-		page_list[i] = alloc_page(gfp_mask);
-		if (page_list[i] == NULL)
-			goto out;
+	for (k = 0; k < NUM_ORDERS && i < n_pages; k++) {
+		while (n_pages - i >= (1 << orders[k])) {
+			page = ion_page_pool_alloc(&sys_heap->pools[k]);
+			if (!page)
+				break;
+			for (j = 0; j < (1 << orders[k]); j++)
+				page_list[i++] = page + j;
+		}
 	}
+	if (i < n_pages)
+		goto out;
 
 	buffer->priv_virt = page_list;
 	return 0;
 
 out:
-	/* failed on i, so go to i-1 */
-	i--;
-
-	for (; i >= 0; i--)
-		__free_page(page_list[i]);
+	/* the chunks are untouched, so they go straight back to the pools */
+	for (j = 0; j < i; j += 1 << page_private(page_list[j]))
+		ion_page_pool_add(&sys_heap->pools[
+				  order_to_index(page_private(page_list[j]))],
+				  page_list[j]);
 
 	kfree(page_list);
 	return -ENOMEM;
@@ -56,12 +222,17 @@ out:
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
+	struct ion_system_heap *sys_heap =
+		container_of(buffer->heap, struct ion_system_heap, heap);
 	int i;
 	int n_pages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
 	struct page **page_list = (struct page **)buffer->priv_virt;
 
-	for (i = 0; i < n_pages; i++)
-		__free_page(page_list[i]);
+	spin_lock(&sys_heap->free_lock);
+	for (i = 0; i < n_pages; i += 1 << page_private(page_list[i]))
+		list_add_tail(&page_list[i]->lru, &sys_heap->free_list);
+	spin_unlock(&sys_heap->free_lock);
+	schedule_work(&sys_heap->free_work);
 	kfree(page_list);
 }
 
@@ -149,19 +320,45 @@ static struct ion_heap_ops vmalloc_ops = {
 
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *sys_heap;
+	struct ion_page_pool *pool;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
-	if (!heap)
+	sys_heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
+	if (!sys_heap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
-	return heap;
+	sys_heap->heap.ops = &vmalloc_ops;
+	sys_heap->heap.type = ION_HEAP_TYPE_SYSTEM;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		pool = &sys_heap->pools[i];
+		spin_lock_init(&pool->lock);
+		INIT_LIST_HEAD(&pool->items);
+		pool->order = orders[i];
+		pool->gfp_mask = orders[i] ? high_order_gfp_flags :
+					     low_order_gfp_flags;
+	}
+	spin_lock_init(&sys_heap->free_lock);
+	INIT_LIST_HEAD(&sys_heap->free_list);
+	INIT_WORK(&sys_heap->free_work, ion_system_heap_free_work);
+	sys_heap->shrinker.shrink = ion_system_heap_shrink;
+	sys_heap->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&sys_heap->shrinker);
+
+	return &sys_heap->heap;
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys_heap =
+		container_of(heap, struct ion_system_heap, heap);
+	int i;
+
+	unregister_shrinker(&sys_heap->shrinker);
+	flush_work_sync(&sys_heap->free_work);
+	for (i = 0; i < NUM_ORDERS; i++)
+		ion_page_pool_shrink(&sys_heap->pools[i], INT_MAX);
+	kfree(sys_heap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
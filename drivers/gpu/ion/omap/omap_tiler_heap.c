@@ -454,6 +454,20 @@ int omap_tiler_heap_inval_user(struct ion_buffer *buffer, size_t len,
 	return omap_tiler_cache_operation(buffer, len, vaddr, CACHE_INVALIDATE);
 }
 
+static int omap_tiler_heap_outer_range(struct ion_buffer *buffer,
+				       size_t offset, size_t len,
+				       enum cache_operation op)
+{
+	struct omap_tiler_info *info = buffer->priv_virt;
+
+	/* only 1D buffers are mapped cacheable, and they are contiguous */
+	if (TILER_PIXEL_FMT_PAGE != info->fmt)
+		return -EINVAL;
+
+	ion_outer_cache_range(info->tiler_addrs[0] + offset, len, op);
+	return 0;
+}
+
 static struct ion_heap_ops omap_tiler_ops = {
 	.allocate = omap_tiler_heap_allocate,
 	.free = omap_tiler_heap_free,
@@ -461,6 +475,7 @@ static struct ion_heap_ops omap_tiler_ops = {
 	.map_user = omap_tiler_heap_map_user,
 	.flush_user = omap_tiler_heap_flush_user,
 	.inval_user = omap_tiler_heap_inval_user,
+	.outer_range = omap_tiler_heap_outer_range,
 };
 
 struct ion_heap *omap_tiler_heap_create(struct ion_platform_heap *data)
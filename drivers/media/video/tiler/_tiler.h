@@ -57,6 +57,7 @@ struct security_info {
 	struct list_head list;		/* other processes */
 	struct list_head groups;	/* my groups */
 	struct list_head bufs;		/* my registered buffers */
+	struct list_head pool;		/* my freed blocks kept for reuse */
 	int token;			/* really: thread group ID or user
 					   provided token */
 	u32 refs;			/* open tiler devices, 0 for processes
@@ -90,6 +91,7 @@ struct area_info {
 
 	struct tcm_area area;		/* area details */
 	struct gid_info *gi;		/* link to parent, if still alive */
+	u16 align;			/* area alignment (in slots) */
 
 	u32 allowed_modes;
 };
@@ -102,6 +104,7 @@ struct mem_info {
 	struct tcm_area area;
 	int refs;			/* number of times referenced */
 	bool alloced;			/* still alloced */
+	bool movable;			/* owner allows moving the block */
 
 	struct list_head by_area;	/* blocks in the same area / 1D */
 	void *parent;			/* area info for 2D, else group info */
@@ -181,6 +184,7 @@ struct tiler_ops {
 };
 
 void tiler_iface_init(struct tiler_ops *tiler);
+void tiler_iface_exit(void);
 void tiler_geom_init(struct tiler_ops *tiler);
 void tiler_reserve_init(struct tiler_ops *tiler);
 void tiler_nv12_init(struct tiler_ops *tiler);
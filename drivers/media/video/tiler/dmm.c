@@ -40,6 +40,9 @@
 #define DEBUG(x, y)
 #endif
 
+/* a chain refills at most the whole container, so allow plenty of time */
+#define DMM_CHAIN_TIMEOUT 10000		/* us */
+
 static struct mutex dmm_mtx;
 
 static struct omap_dmm_platform_data *device_data;
@@ -69,6 +72,47 @@ static struct platform_driver dmm_driver_ldm = {
 	},
 };
 
+/* acknowledge a completed refill, and check that it did not fail */
+static s32 dmm_pat_ack(struct dmm *dmm)
+{
+	void __iomem *r;
+	u32 v, i;
+
+	/* Again, clear the DMM_PAT_IRQSTATUS register */
+	r = dmm->base + DMM_PAT_IRQSTATUS;
+	__raw_writel(0xFFFFFFFF, r);
+	wmb();
+
+	r = dmm->base + DMM_PAT_IRQSTATUS_RAW;
+	i = 1000;
+	while (__raw_readl(r) != 0x0) {
+		if (--i == 0) {
+			printk(KERN_ERR "Failed to clear DMM PAT IRQSTATUS\n");
+			return -EFAULT;
+		}
+		udelay(1);
+	}
+
+	/* Again, set "next" register to NULL to clear any PAT STATUS errors */
+	r = dmm->base + DMM_PAT_DESCR__0;
+	v = __raw_readl(r);
+	v = SET_FLD(v, 31, 4, (u32) NULL);
+	__raw_writel(v, r);
+
+	/*
+	 * Now, check that the DMM_PAT_STATUS register
+	 * has not reported an error before exiting.
+	*/
+	r = dmm->base + DMM_PAT_STATUS__0;
+	v = __raw_readl(r);
+	if ((v & 0xFC00) != 0) {
+		printk(KERN_ERR "Abort dmm refill.  Operation failed\n");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 s32 dmm_pat_refill(struct dmm *dmm, struct pat *pd, enum pat_mode mode)
 {
 	s32 ret = -EFAULT;
@@ -169,46 +213,76 @@ s32 dmm_pat_refill(struct dmm *dmm, struct pat *pd, enum pat_mode mode)
 		udelay(1);
 	}
 
-	/* Again, clear the DMM_PAT_IRQSTATUS register */
+	ret = dmm_pat_ack(dmm);
+
+refill_error:
+	mutex_unlock(&dmm_mtx);
+
+	return ret;
+}
+EXPORT_SYMBOL(dmm_pat_refill);
+
+s32 dmm_pat_refill_chain(struct dmm *dmm, u32 desc_pa)
+{
+	s32 ret = -EFAULT;
+	void __iomem *r;
+	u32 v, i;
+
+	/* descriptors must be 16 aligned */
+	BUG_ON(desc_pa & 15);
+
+	mutex_lock(&dmm_mtx);
+
+	/* Check that the DMM_PAT_STATUS register has not reported an error */
+	r = dmm->base + DMM_PAT_STATUS__0;
+	v = __raw_readl(r);
+	if (WARN(v & 0xFC00, KERN_ERR "Abort dmm refill, bad status\n")) {
+		ret = -EIO;
+		goto refill_error;
+	}
+
+	/* First, clear the DMM_PAT_IRQSTATUS register */
 	r = dmm->base + DMM_PAT_IRQSTATUS;
 	__raw_writel(0xFFFFFFFF, r);
 	wmb();
 
 	r = dmm->base + DMM_PAT_IRQSTATUS_RAW;
 	i = 1000;
-	while (__raw_readl(r) != 0x0) {
+	while (__raw_readl(r) != 0) {
 		if (--i == 0) {
-			printk(KERN_ERR "Failed to clear DMM PAT IRQSTATUS\n");
+			printk(KERN_ERR "Cannot clear status register\n");
 			goto refill_error;
 		}
 		udelay(1);
 	}
 
-	/* Again, set "next" register to NULL to clear any PAT STATUS errors */
+	/* Point "next" register to the chain, which starts the refill */
 	r = dmm->base + DMM_PAT_DESCR__0;
 	v = __raw_readl(r);
-	v = SET_FLD(v, 31, 4, (u32) NULL);
+	v = SET_FLD(v, 31, 4, desc_pa >> 4);
 	__raw_writel(v, r);
+	wmb();
 
-	/*
-	 * Now, check that the DMM_PAT_STATUS register
-	 * has not reported an error before exiting.
-	*/
-	r = dmm->base + DMM_PAT_STATUS__0;
-	v = __raw_readl(r);
-	if ((v & 0xFC00) != 0) {
-		printk(KERN_ERR "Abort dmm refill.  Operation failed\n");
-		goto refill_error;
+	/* Only wait for the last descriptor, but stop on any error */
+	r = dmm->base + DMM_PAT_IRQSTATUS_RAW;
+	i = DMM_CHAIN_TIMEOUT;
+	while (!((v = __raw_readl(r)) & 0x2)) {
+		if ((v & 0xFC) || --i == 0) {
+			printk(KERN_ERR "Status check failed after PAT chain "
+					"refill (%08x)\n", v);
+			goto refill_error;
+		}
+		udelay(1);
 	}
 
-	ret = 0;
+	ret = dmm_pat_ack(dmm);
 
 refill_error:
 	mutex_unlock(&dmm_mtx);
 
 	return ret;
 }
-EXPORT_SYMBOL(dmm_pat_refill);
+EXPORT_SYMBOL(dmm_pat_refill_chain);
 
 struct dmm *dmm_pat_init(u32 id)
 {
@@ -57,6 +57,7 @@ struct tcm_area {
 
 struct tcm {
 	u16 width, height;	/* container dimensions */
+	atomic_t used;		/* number of reserved slots */
 
 	/* 'pvt' structure shall contain any tcm details (attr) along with
 	linked list of allocated areas and mutex for mutually exclusive access
@@ -76,6 +77,8 @@ struct tcm {
     BASIC TILER CONTAINER MANAGER INTERFACE
 =============================================================================*/
 
+static inline u16 __tcm_sizeof(struct tcm_area *area);
+
 /*
  * NOTE:
  *
@@ -155,6 +158,8 @@ static inline s32 tcm_reserve_2d(struct tcm *tcm, u16 width, u16 height,
 		area->is2d = true;
 		res = tcm->reserve_2d(tcm, height, width, align, area);
 		area->tcm = res ? NULL : tcm;
+		if (!res)
+			atomic_add(width * height, &tcm->used);
 	}
 
 	return res;
@@ -185,6 +190,8 @@ static inline s32 tcm_reserve_1d(struct tcm *tcm, u32 slots,
 		area->is2d = false;
 		res = tcm->reserve_1d(tcm, slots, area);
 		area->tcm = res ? NULL : tcm;
+		if (!res)
+			atomic_add(slots, &tcm->used);
 	}
 
 	return res;
@@ -209,8 +216,10 @@ static inline s32 tcm_free(struct tcm_area *area)
 
 	if (area && area->tcm) {
 		res = area->tcm->free(area->tcm, area);
-		if (res == 0)
+		if (res == 0) {
+			atomic_sub(__tcm_sizeof(area), &area->tcm->used);
 			area->tcm = NULL;
+		}
 	}
 
 	return res;
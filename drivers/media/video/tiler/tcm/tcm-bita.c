@@ -0,0 +1,842 @@
+/*
+ * tcm-bita.c
+ *
+ * Bitmap-indexed Tiler Allocator (BiTA): 2D and 1D allocation(reservation)
+ * algorithm
+ *
+ * BiTA follows SiTA's placement rules and scoring (see tcm-sita.c), but
+ * instead of keeping a parent pointer for every slot and probing candidate
+ * areas slot by slot, it keeps:
+ *
+ *   - a raster-order occupancy bitmap of the container, so that each row of
+ *     a candidate area is checked a word at a time with find_next_bit(), and
+ *     a failed candidate skips the whole busy run that it ran into, and
+ *   - the number of free slots in each row, so that candidate rows that
+ *     cannot take the area are skipped without looking at the bitmap.
+ *
+ * Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ */
+#include <linux/slab.h>
+#include <linux/bitmap.h>
+
+#include "_tcm-sita.h"		/* scoring is shared with SiTA */
+#include "tcm-bita.h"
+
+#define TCM_ALG_NAME "tcm_bita"
+#include "tcm-utils.h"
+
+#define X_SCAN_LIMITER	1
+#define Y_SCAN_LIMITER	1
+
+#define ALIGN_DOWN(value, align) ((value) & ~((align) - 1))
+
+/* index of a slot in the occupancy bitmap */
+#define SLOT(tcm, x, y) ((y) * (tcm)->width + (x))
+
+/* Individual selection criteria for different scan areas */
+static s32 CR_L2R_T2B = CR_BIAS_HORIZONTAL;
+static s32 CR_R2L_T2B = CR_DIAGONAL_BALANCE;
+
+struct bita_pvt {
+	struct mutex mtx;
+	struct tcm_pt div_pt;	/* divider point splitting container */
+	unsigned long *map;	/* slot occupancy in raster order */
+	u16 *free;		/* number of free slots in each row */
+};
+
+/*********************************************
+ *	TCM API - BiTA Implementation
+ *********************************************/
+static s32 bita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
+			   struct tcm_area *area);
+static s32 bita_reserve_1d(struct tcm *tcm, u32 slots, struct tcm_area *area);
+static s32 bita_free(struct tcm *tcm, struct tcm_area *area);
+static void bita_deinit(struct tcm *tcm);
+
+/*********************************************
+ *	Main Scanner functions
+ *********************************************/
+static s32 scan_areas_and_find_fit(struct tcm *tcm, u16 w, u16 h, u16 align,
+				   struct tcm_area *area);
+
+static s32 scan_l2r_t2b(struct tcm *tcm, u16 w, u16 h, u16 align,
+			struct tcm_area *field, struct tcm_area *area);
+
+static s32 scan_r2l_t2b(struct tcm *tcm, u16 w, u16 h, u16 align,
+			struct tcm_area *field, struct tcm_area *area);
+
+static s32 scan_r2l_b2t_one_dim(struct tcm *tcm, u32 num_slots,
+			struct tcm_area *field, struct tcm_area *area);
+
+/*********************************************
+ *	Support Infrastructure Methods
+ *********************************************/
+static s32 rows_to_skip(struct tcm *tcm, u16 y0, u16 w, u16 h);
+
+static s32 fit_l2r(struct tcm *tcm, u16 y, u16 w, u16 h, s32 x, s32 end_x,
+		   u16 align, s32 *next_y);
+
+static s32 fit_r2l(struct tcm *tcm, u16 y, u16 w, u16 h, s32 x, s32 end_x,
+		   u16 align, s32 *next_y);
+
+static s32 update_candidate(struct tcm *tcm, u16 x0, u16 y0, u16 w, u16 h,
+			    struct tcm_area *field, s32 criteria,
+			    struct score *best);
+
+static void get_nearness_factor(struct tcm_area *field,
+				struct tcm_area *candidate,
+				struct nearness_factor *nf);
+
+static void get_neighbor_stats(struct tcm *tcm, struct tcm_area *area,
+			       struct neighbor_stats *stat);
+
+static bool is_area_busy(struct tcm *tcm, struct tcm_area *area);
+
+static void fill_area(struct tcm *tcm, struct tcm_area *area, bool busy);
+
+/*********************************************/
+
+/*********************************************
+ *	Utility Methods
+ *********************************************/
+struct tcm *bita_init(u16 width, u16 height, struct tcm_pt *attr)
+{
+	struct tcm *tcm;
+	struct bita_pvt *pvt;
+	s32 i;
+
+	if (width == 0 || height == 0)
+		return NULL;
+
+	tcm = kzalloc(sizeof(*tcm), GFP_KERNEL);
+	pvt = kzalloc(sizeof(*pvt), GFP_KERNEL);
+	if (!tcm || !pvt)
+		goto error;
+
+	/* Updating the pointers to BiTA implementation APIs */
+	tcm->height = height;
+	tcm->width = width;
+	tcm->reserve_2d = bita_reserve_2d;
+	tcm->reserve_1d = bita_reserve_1d;
+	tcm->free = bita_free;
+	tcm->deinit = bita_deinit;
+	tcm->pvt = (void *)pvt;
+
+	mutex_init(&(pvt->mtx));
+
+	pvt->map = kzalloc(BITS_TO_LONGS(width * height) * sizeof(*pvt->map),
+			   GFP_KERNEL);
+	pvt->free = kmalloc(height * sizeof(*pvt->free), GFP_KERNEL);
+	if (!pvt->map || !pvt->free)
+		goto error;
+
+	for (i = 0; i < height; i++)
+		pvt->free[i] = width;
+
+	if (attr && attr->x <= tcm->width && attr->y <= tcm->height) {
+		pvt->div_pt.x = attr->x;
+		pvt->div_pt.y = attr->y;
+
+	} else {
+		/* Defaulting to 3:1 ratio on width for 2D area split */
+		/* Defaulting to 3:1 ratio on height for 2D and 1D split */
+		pvt->div_pt.x = (tcm->width * 3) / 4;
+		pvt->div_pt.y = (tcm->height * 3) / 4;
+	}
+
+	return tcm;
+
+error:
+	if (pvt) {
+		kfree(pvt->map);
+		kfree(pvt->free);
+	}
+	kfree(tcm);
+	kfree(pvt);
+	return NULL;
+}
+
+static void bita_deinit(struct tcm *tcm)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	mutex_destroy(&(pvt->mtx));
+
+	kfree(pvt->map);
+	kfree(pvt->free);
+	kfree(pvt);
+}
+
+/**
+ * Reserve a 1D area in the container
+ *
+ * @param num_slots	size of 1D area
+ * @param area		pointer to the area that will be populated with the
+ *			reserved area
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 bita_reserve_1d(struct tcm *tcm, u32 num_slots,
+			   struct tcm_area *area)
+{
+	s32 ret;
+	struct tcm_area field = {0};
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	mutex_lock(&(pvt->mtx));
+	/* Scanning entire container */
+	assign(&field, tcm->width - 1, tcm->height - 1, 0, 0);
+
+	ret = scan_r2l_b2t_one_dim(tcm, num_slots, &field, area);
+	if (!ret)
+		/* update map */
+		fill_area(tcm, area, true);
+
+	mutex_unlock(&(pvt->mtx));
+	return ret;
+}
+
+/**
+ * Reserve a 2D area in the container
+ *
+ * @param w	width
+ * @param h	height
+ * @param area	pointer to the area that will be populated with the reesrved
+ *		area
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 bita_reserve_2d(struct tcm *tcm, u16 h, u16 w, u8 align,
+			   struct tcm_area *area)
+{
+	s32 ret;
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	/* not supporting more than 64 as alignment */
+	if (align > 64)
+		return -EINVAL;
+
+	/* we prefer 1, 32 and 64 as alignment */
+	align = align <= 1 ? 1 : align <= 32 ? 32 : 64;
+
+	mutex_lock(&(pvt->mtx));
+	ret = scan_areas_and_find_fit(tcm, w, h, align, area);
+	if (!ret)
+		/* update map */
+		fill_area(tcm, area, true);
+
+	mutex_unlock(&(pvt->mtx));
+	return ret;
+}
+
+/**
+ * Unreserve a previously allocated 2D or 1D area
+ * @param area	area to be freed
+ * @return 0 - success
+ */
+static s32 bita_free(struct tcm *tcm, struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	mutex_lock(&(pvt->mtx));
+
+	/* check that this is in fact an existing area */
+	WARN_ON(!is_area_busy(tcm, area));
+
+	/* Clear the contents of the associated tiles in the map */
+	fill_area(tcm, area, false);
+
+	mutex_unlock(&(pvt->mtx));
+
+	return 0;
+}
+
+/**
+ * Note: In general the cordinates in the scan field area relevant to the can
+ * sweep directions. The scan origin (e.g. top-left corner) will always be
+ * the p0 member of the field.  Therfore, for a scan from top-left p0.x <= p1.x
+ * and p0.y <= p1.y; whereas, for a scan from bottom-right p1.x <= p0.x and p1.y
+ * <= p0.y
+ */
+
+/**
+ * Raster scan horizontally right to left from top to bottom to find a place for
+ * a 2D area of given size inside a scan field.
+ *
+ * @param w	width of desired area
+ * @param h	height of desired area
+ * @param align	desired area alignment
+ * @param area	pointer to the area that will be set to the best position
+ * @param field	area to scan (inclusive)
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 scan_r2l_t2b(struct tcm *tcm, u16 w, u16 h, u16 align,
+			struct tcm_area *field, struct tcm_area *area)
+{
+	s32 x, y, skip, next_y;
+	s16 start_x, end_x, start_y, end_y, found_x = -1;
+	struct score best = {{0}, {0}, {0}, 0};
+
+	PA(2, "scan_r2l_t2b:", field);
+
+	start_x = field->p0.x;
+	end_x = field->p1.x;
+	start_y = field->p0.y;
+	end_y = field->p1.y;
+
+	/* check scan area co-ordinates */
+	if (field->p0.x < field->p1.x ||
+	    field->p1.y < field->p0.y)
+		return -EINVAL;
+
+	/* check if allocation would fit in scan area */
+	if (w > LEN(start_x, end_x) || h > LEN(end_y, start_y))
+		return -ENOSPC;
+
+	/* adjust start_x and end_y, as allocation would not fit beyond */
+	start_x = ALIGN_DOWN(start_x - w + 1, align); /* - 1 to be inclusive */
+	end_y = end_y - h + 1;
+
+	/* check if allocation would still fit in scan area */
+	if (start_x < end_x)
+		return -ENOSPC;
+
+	P2("ali=%d x=%d..%d y=%d..%d", align, start_x, end_x, start_y, end_y);
+
+	/* scan field top-to-bottom, right-to-left */
+	for (y = start_y; y <= end_y; y++) {
+		skip = rows_to_skip(tcm, y, w, h);
+		if (skip) {
+			y += skip - 1;
+			continue;
+		}
+
+		x = fit_r2l(tcm, y, w, h, start_x, end_x, align, &next_y);
+		if (x < 0) {
+			/* no row above next_y can fit the area either */
+			y = next_y - 1;
+			continue;
+		}
+
+		P3("found shoulder: %d,%d", x, y);
+		found_x = x;
+
+		/* update best candidate */
+		if (update_candidate(tcm, x, y, w, h, field, CR_R2L_T2B, &best))
+			goto done;
+
+#ifdef X_SCAN_LIMITER
+		/* change upper x bound */
+		end_x = x + 1;
+#endif
+#ifdef Y_SCAN_LIMITER
+		/* break if you find a free area shouldering the scan field */
+		if (found_x == start_x)
+			break;
+#endif
+	}
+
+	if (!best.a.tcm)
+		return -ENOSPC;
+done:
+	assign(area, best.a.p0.x, best.a.p0.y, best.a.p1.x, best.a.p1.y);
+	return 0;
+}
+
+/**
+ * Raster scan horizontally left to right from top to bottom to find a place for
+ * a 2D area of given size inside a scan field.
+ *
+ * @param w	width of desired area
+ * @param h	height of desired area
+ * @param align	desired area alignment
+ * @param area	pointer to the area that will be set to the best position
+ * @param field	area to scan (inclusive)
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 scan_l2r_t2b(struct tcm *tcm, u16 w, u16 h, u16 align,
+			struct tcm_area *field, struct tcm_area *area)
+{
+	s32 x, y, skip, next_y;
+	s16 start_x, end_x, start_y, end_y, found_x = -1;
+	struct score best = {{0}, {0}, {0}, 0};
+
+	PA(2, "scan_l2r_t2b:", field);
+
+	start_x = field->p0.x;
+	end_x = field->p1.x;
+	start_y = field->p0.y;
+	end_y = field->p1.y;
+
+	/* check scan area co-ordinates */
+	if (field->p1.x < field->p0.x ||
+	    field->p1.y < field->p0.y)
+		return -EINVAL;
+
+	/* check if allocation would fit in scan area */
+	if (w > LEN(end_x, start_x) || h > LEN(end_y, start_y))
+		return -ENOSPC;
+
+	start_x = ALIGN(start_x, align);
+
+	/* check if allocation would still fit in scan area */
+	if (w > LEN(end_x, start_x))
+		return -ENOSPC;
+
+	/* adjust end_x and end_y, as allocation would not fit beyond */
+	end_x = end_x - w + 1; /* + 1 to be inclusive */
+	end_y = end_y - h + 1;
+
+	P2("ali=%d x=%d..%d y=%d..%d", align, start_x, end_x, start_y, end_y);
+
+	/* scan field top-to-bottom, left-to-right */
+	for (y = start_y; y <= end_y; y++) {
+		skip = rows_to_skip(tcm, y, w, h);
+		if (skip) {
+			y += skip - 1;
+			continue;
+		}
+
+		x = fit_l2r(tcm, y, w, h, start_x, end_x, align, &next_y);
+		if (x < 0) {
+			/* no row above next_y can fit the area either */
+			y = next_y - 1;
+			continue;
+		}
+
+		P3("found shoulder: %d,%d", x, y);
+		found_x = x;
+
+		/* update best candidate */
+		if (update_candidate(tcm, x, y, w, h, field, CR_L2R_T2B, &best))
+			goto done;
+
+#ifdef X_SCAN_LIMITER
+		/* change upper x bound */
+		end_x = x - 1;
+#endif
+#ifdef Y_SCAN_LIMITER
+		/* break if you find a free area shouldering the scan field */
+		if (found_x == start_x)
+			break;
+#endif
+	}
+
+	if (!best.a.tcm)
+		return -ENOSPC;
+done:
+	assign(area, best.a.p0.x, best.a.p0.y, best.a.p1.x, best.a.p1.y);
+	return 0;
+}
+
+/**
+ * Find a place for a 1D area of given size inside a scan field.  As SiTA,
+ * this picks the free slot range that ends closest to the bottom-right corner
+ * of the field.
+ *
+ * @param num_slots	size of desired area
+ * @param area		pointer to the area that will be set to the best
+ *			position
+ * @param field		area to scan (inclusive)
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 scan_r2l_b2t_one_dim(struct tcm *tcm, u32 num_slots,
+				struct tcm_area *field, struct tcm_area *area)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	unsigned long pos, start, end, last = 0;
+
+	/* check scan area co-ordinates */
+	if (field->p0.y < field->p1.y)
+		return -EINVAL;
+
+	PA(2, "scan_r2l_b2t_one_dim:", field);
+
+	/**
+	 * Currently we only support full width 1D scan field, which makes sense
+	 * since 1D slot-ordering spans the full container width.
+	 */
+	if (tcm->width != field->p0.x - field->p1.x + 1)
+		return -EINVAL;
+
+	/* check if allocation would fit in scan area */
+	if (num_slots > tcm->width * LEN(field->p0.y, field->p1.y))
+		return -ENOSPC;
+
+	pos = SLOT(tcm, 0, field->p1.y);
+	end = SLOT(tcm, 0, field->p0.y + 1);
+
+	/* walk the free runs and remember the end of the last one that fits */
+	while (pos < end) {
+		start = find_next_zero_bit(pvt->map, end, pos);
+		if (start >= end)
+			break;
+		pos = find_next_bit(pvt->map, end, start);
+		if (pos - start >= num_slots)
+			last = pos;
+	}
+
+	if (!last)
+		return -ENOSPC;
+
+	area->p1.x = (last - 1) % tcm->width;
+	area->p1.y = (last - 1) / tcm->width;
+	area->p0.x = (last - num_slots) % tcm->width;
+	area->p0.y = (last - num_slots) / tcm->width;
+	return 0;
+}
+
+/**
+ * Find a place for a 2D area of given size inside a scan field based on its
+ * alignment needs.
+ *
+ * @param w	width of desired area
+ * @param h	height of desired area
+ * @param align	desired area alignment
+ * @param area	pointer to the area that will be set to the best position
+ *
+ * @return 0 on success, non-0 error value on failure.
+ */
+static s32 scan_areas_and_find_fit(struct tcm *tcm, u16 w, u16 h, u16 align,
+				   struct tcm_area *area)
+{
+	s32 ret = 0;
+	struct tcm_area field = {0};
+	u16 boundary_x, boundary_y;
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	if (align > 1) {
+		/* prefer top-left corner */
+		boundary_x = pvt->div_pt.x - 1;
+		boundary_y = pvt->div_pt.y - 1;
+
+		/* expand width and height if needed */
+		if (w > pvt->div_pt.x)
+			boundary_x = tcm->width - 1;
+		if (h > pvt->div_pt.y)
+			boundary_y = tcm->height - 1;
+
+		assign(&field, 0, 0, boundary_x, boundary_y);
+		ret = scan_l2r_t2b(tcm, w, h, align, &field, area);
+
+		/* scan whole container if failed, but do not scan 2x */
+		if (ret != 0 && (boundary_x != tcm->width - 1 ||
+				 boundary_y != tcm->height - 1)) {
+			/* scan the entire container if nothing found */
+			assign(&field, 0, 0, tcm->width - 1, tcm->height - 1);
+			ret = scan_l2r_t2b(tcm, w, h, align, &field, area);
+		}
+	} else if (align == 1) {
+		/* prefer top-right corner */
+		boundary_x = pvt->div_pt.x;
+		boundary_y = pvt->div_pt.y - 1;
+
+		/* expand width and height if needed */
+		if (w > (tcm->width - pvt->div_pt.x))
+			boundary_x = 0;
+		if (h > pvt->div_pt.y)
+			boundary_y = tcm->height - 1;
+
+		assign(&field, tcm->width - 1, 0, boundary_x, boundary_y);
+		ret = scan_r2l_t2b(tcm, w, h, align, &field, area);
+
+		/* scan whole container if failed, but do not scan 2x */
+		if (ret != 0 && (boundary_x != 0 ||
+				 boundary_y != tcm->height - 1)) {
+			/* scan the entire container if nothing found */
+			assign(&field, tcm->width - 1, 0, 0, tcm->height - 1);
+			ret = scan_r2l_t2b(tcm, w, h, align, &field,
+					   area);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Rows y0 .. y0 + h - 1 can only hold an area of width w if each of them has
+ * at least w free slots.
+ *
+ * @return 0 if they may hold the area, or else the number of rows the scan can
+ * advance, as no area overlapping the last row that is too full will fit.
+ */
+static s32 rows_to_skip(struct tcm *tcm, u16 y0, u16 w, u16 h)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	s32 y;
+
+	for (y = y0 + h - 1; y >= y0; y--)
+		if (pvt->free[y] < w)
+			return y - y0 + 1;
+	return 0;
+}
+
+/*
+ * Find a busy slot in the bottom-most row of the area at x0, y0 of size w * h
+ * that has any.  Returns the row of the slot, and sets *busy to its column, or
+ * returns -1 if all slots are free.
+ */
+static s32 find_busy(struct tcm *tcm, u16 x0, u16 y0, u16 w, u16 h,
+		     s32 *busy)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	unsigned long slot;
+	s32 y;
+
+	for (y = y0 + h - 1; y >= y0; y--) {
+		slot = find_next_bit(pvt->map, SLOT(tcm, x0 + w, y),
+				     SLOT(tcm, x0, y));
+		if (slot < SLOT(tcm, x0 + w, y)) {
+			*busy = slot - SLOT(tcm, 0, y);
+			return y;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Find the first position with alignment align, scanning left to right from x
+ * to end_x (inclusive), for an area of given size starting at row y.
+ *
+ * @param next_y	set to the first row below y worth scanning if there is
+ *			no such position.  Every position tried overlaps a busy
+ *			slot, and so does the same position in any row up to
+ *			that slot's.
+ *
+ * @return x coordinate of the position, or -1 if there is none
+ */
+static s32 fit_l2r(struct tcm *tcm, u16 y, u16 w, u16 h, s32 x, s32 end_x,
+		   u16 align, s32 *next_y)
+{
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	s32 busy, row;
+
+	*next_y = tcm->height;
+	while (x <= end_x) {
+		row = find_busy(tcm, x, y, w, h, &busy);
+		if (row < 0)
+			return x;
+		*next_y = min(*next_y, row + 1);
+
+		/* no position overlapping this busy run will fit */
+		busy = find_next_zero_bit(pvt->map, SLOT(tcm, 0, row + 1),
+					  SLOT(tcm, busy, row));
+		x = ALIGN(busy - SLOT(tcm, 0, row), align);
+	}
+	return -1;
+}
+
+/**
+ * Find the first position with alignment align, scanning right to left from x
+ * to end_x (inclusive), for an area of given size starting at row y.
+ *
+ * @param next_y	set as for fit_l2r()
+ *
+ * @return x coordinate of the position, or -1 if there is none
+ */
+static s32 fit_r2l(struct tcm *tcm, u16 y, u16 w, u16 h, s32 x, s32 end_x,
+		   u16 align, s32 *next_y)
+{
+	s32 busy, row;
+
+	*next_y = tcm->height;
+	while (x >= end_x) {
+		row = find_busy(tcm, x, y, w, h, &busy);
+		if (row < 0)
+			return x;
+		*next_y = min(*next_y, row + 1);
+
+		/* move left of the busy slot */
+		x = ALIGN_DOWN(busy - w, align);
+	}
+	return -1;
+}
+
+/* check if an entire area is busy */
+static bool is_area_busy(struct tcm *tcm, struct tcm_area *area)
+{
+	s32 y;
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	struct tcm_area a, a_;
+
+	tcm_for_each_slice(a, *area, a_) {
+		for (y = a.p0.y; y <= a.p1.y; y++)
+			if (find_next_zero_bit(pvt->map,
+					       SLOT(tcm, a.p1.x + 1, y),
+					       SLOT(tcm, a.p0.x, y)) <=
+			    SLOT(tcm, a.p1.x, y))
+				return false;
+	}
+	return true;
+}
+
+/* marks the slots of an area busy or free */
+static void fill_area(struct tcm *tcm, struct tcm_area *area, bool busy)
+{
+	s32 y;
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+	struct tcm_area a, a_;
+
+	/* set area's tcm; otherwise, enumerator considers it invalid */
+	area->tcm = tcm;
+
+	tcm_for_each_slice(a, *area, a_) {
+		PA(2, "fill 2d area", &a);
+		for (y = a.p0.y; y <= a.p1.y; y++) {
+			if (busy) {
+				bitmap_set(pvt->map, SLOT(tcm, a.p0.x, y),
+					   tcm_awidth(a));
+				pvt->free[y] -= tcm_awidth(a);
+			} else {
+				bitmap_clear(pvt->map, SLOT(tcm, a.p0.x, y),
+					     tcm_awidth(a));
+				pvt->free[y] += tcm_awidth(a);
+			}
+		}
+	}
+}
+
+/**
+ * Compares a candidate area to the current best area, and if it is a better
+ * fit, it updates the best to this one.
+ *
+ * @param x0, y0, w, h		top, left, width, height of candidate area
+ * @param field			scan field
+ * @param criteria		scan criteria
+ * @param best			best candidate and its scores
+ *
+ * @return 1 (true) if the candidate area is known to be the final best, so no
+ * more searching should be performed
+ */
+static s32 update_candidate(struct tcm *tcm, u16 x0, u16 y0, u16 w, u16 h,
+			    struct tcm_area *field, s32 criteria,
+			    struct score *best)
+{
+	struct score me;	/* score for area */
+
+	/*
+	 * If first found is enabled then we stop looking
+	 * NOTE: For horizontal bias we always give the first found, because our
+	 * scan is horizontal-raster-based and the first candidate will always
+	 * have the horizontal bias.
+	 */
+	bool first = criteria & (CR_FIRST_FOUND | CR_BIAS_HORIZONTAL);
+
+	assign(&me.a, x0, y0, x0 + w - 1, y0 + h - 1);
+
+	/* calculate score for current candidate */
+	if (!first) {
+		get_neighbor_stats(tcm, &me.a, &me.n);
+		me.neighs = me.n.edge + me.n.busy;
+		get_nearness_factor(field, &me.a, &me.f);
+	}
+
+	/* the 1st candidate is always the best */
+	if (!best->a.tcm)
+		goto better;
+
+	BUG_ON(first);
+
+	/* see if this are is better than the best so far */
+
+	/* neighbor check */
+	if ((criteria & CR_MAX_NEIGHS) &&
+		me.neighs > best->neighs)
+		goto better;
+
+	/* vertical bias check */
+	if ((criteria & CR_BIAS_VERTICAL) &&
+	/*
+	 * NOTE: not checking if lengths are same, because that does not
+	 * find new shoulders on the same row after a fit
+	 */
+		LEN(me.a.p0.y, field->p0.y) >
+		LEN(best->a.p0.y, field->p0.y))
+		goto better;
+
+	/* diagonal balance check */
+	if ((criteria & CR_DIAGONAL_BALANCE) &&
+		best->neighs <= me.neighs &&
+		(best->neighs < me.neighs ||
+		 /* this implies that neighs and occupied match */
+		 best->n.busy < me.n.busy ||
+		 (best->n.busy == me.n.busy &&
+		  /* check the nearness factor */
+		  best->f.x + best->f.y > me.f.x + me.f.y)))
+		goto better;
+
+	/* not better, keep going */
+	return 0;
+
+better:
+	/* save current area as best */
+	memcpy(best, &me, sizeof(me));
+	best->a.tcm = tcm;
+	return first;
+}
+
+/**
+ * Calculate the nearness factor of an area in a search field.  The nearness
+ * factor is smaller if the area is closer to the search origin.
+ */
+static void get_nearness_factor(struct tcm_area *field, struct tcm_area *area,
+				struct nearness_factor *nf)
+{
+	/**
+	 * Using signed math as field coordinates may be reversed if
+	 * search direction is right-to-left or bottom-to-top.
+	 */
+	nf->x = (s32)(area->p0.x - field->p0.x) * 1000 /
+		(field->p1.x - field->p0.x);
+	nf->y = (s32)(area->p0.y - field->p0.y) * 1000 /
+		(field->p1.y - field->p0.y);
+}
+
+/* get neighbor statistics */
+static void get_neighbor_stats(struct tcm *tcm, struct tcm_area *area,
+			 struct neighbor_stats *stat)
+{
+	s16 x = 0, y = 0;
+	struct bita_pvt *pvt = (struct bita_pvt *)tcm->pvt;
+
+	/* Clearing any exisiting values */
+	memset(stat, 0, sizeof(*stat));
+
+	/* process top & bottom edges */
+	for (x = area->p0.x; x <= area->p1.x; x++) {
+		if (area->p0.y == 0)
+			stat->edge++;
+		else if (test_bit(SLOT(tcm, x, area->p0.y - 1), pvt->map))
+			stat->busy++;
+
+		if (area->p1.y == tcm->height - 1)
+			stat->edge++;
+		else if (test_bit(SLOT(tcm, x, area->p1.y + 1), pvt->map))
+			stat->busy++;
+	}
+
+	/* process left & right edges */
+	for (y = area->p0.y; y <= area->p1.y; ++y) {
+		if (area->p0.x == 0)
+			stat->edge++;
+		else if (test_bit(SLOT(tcm, area->p0.x - 1, y), pvt->map))
+			stat->busy++;
+
+		if (area->p1.x == tcm->width - 1)
+			stat->edge++;
+		else if (test_bit(SLOT(tcm, area->p1.x + 1, y), pvt->map))
+			stat->busy++;
+	}
+}
@@ -0,0 +1,41 @@
+/*
+ * tcm_bita.h
+ *
+ * Bitmap-indexed Tiler Allocator (BiTA) interface.
+ *
+ * Copyright (C) 2009-2011 Texas Instruments, Inc.
+ *
+ * This package is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * THIS PACKAGE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef TCM_BITA_H
+#define TCM_BITA_H
+
+#include "../tcm.h"
+
+/**
+ * Create a BiTA tiler container manager.
+ *
+ * BiTA places areas exactly where SiTA would, but keeps the container
+ * occupancy in a bitmap so that whole candidate rows can be tested a word
+ * at a time instead of slot by slot.
+ *
+ * @param width  Container width
+ * @param height Container height
+ * @param attr   preferred division point between 64-aligned
+ *		 allocation (top left), 32-aligned allocations
+ *		 (top right), and page mode allocations (bottom)
+ *
+ * @return TCM instance
+ */
+struct tcm *bita_init(u16 width, u16 height, struct tcm_pt *attr);
+
+TCM_INIT(bita_init, struct tcm_pt);
+
+#endif /* TCM_BITA_H */
@@ -25,18 +25,117 @@
 #include <linux/sched.h>	/* current */
 #include <linux/mm.h>
 #include <linux/mm_types.h>
+#include <linux/workqueue.h>
 #include <asm/mach/map.h>	/* for ioremap_page */
 
 #include "_tiler.h"
 
 static bool security = CONFIG_TILER_SECURITY;
+static uint pool_age = 5000;
 
 module_param(security, bool, 0644);
 MODULE_PARM_DESC(security,
 	"Separate allocations by different security ids (pid or token)");
+module_param(pool_age, uint, 0644);
+MODULE_PARM_DESC(pool_age,
+	"Free pooled blocks that were not reused for this long (ms, 0: no pool)");
 
 static struct list_head procs;	/* list of process info structs */
 static struct tiler_ops *ops;	/* shared methods and variables */
+static struct blocking_notifier_head notifier;	/* notifier for events */
+static u32 pool_count;		/* number of pooled blocks */
+static bool pool_flush;		/* free all pooled blocks */
+
+/* a freed block kept for reuse by its process */
+struct pool_info {
+	struct list_head by_sid;	/* pooled blocks of the process */
+	struct tiler_block_t blk;	/* block info */
+	enum tiler_fmt fmt;		/* block format */
+	u32 gid;			/* group ID */
+	unsigned long freed;		/* when the block was pooled */
+};
+
+/*
+ *  Event notification methods
+ *  ==========================================================================
+ */
+
+s32 tiler_notify_event(int event, void *data)
+{
+	return blocking_notifier_call_chain(&notifier, event, data);
+}
+
+/*
+ *  Block pool methods
+ *  ==========================================================================
+ */
+
+/* free pooled blocks that are too old, or all if memory is low */
+static void pool_worker(struct work_struct *work);
+static DECLARE_DELAYED_WORK(pool_work, pool_worker);
+
+static void pool_worker(struct work_struct *work)
+{
+	struct security_info *si;
+	struct pool_info *pi, *pi_;
+	unsigned long age = msecs_to_jiffies(pool_age);
+
+	/* hold the interface mutex, so the processes stay alive */
+	mutex_lock(&ops->mtx);
+	list_for_each_entry(si, &procs, list) {
+		list_for_each_entry_safe(pi, pi_, &si->pool, by_sid) {
+			if (!pool_flush && time_before(jiffies, pi->freed + age))
+				continue;
+
+			list_del(&pi->by_sid);
+			pool_count--;
+			tiler_free(&pi->blk);
+			kfree(pi);
+		}
+	}
+	pool_flush = false;
+
+	if (pool_count)
+		schedule_delayed_work(&pool_work, age);
+	mutex_unlock(&ops->mtx);
+}
+
+/*
+ * The blocks cannot be freed here, as memory may be reclaimed while the
+ * tiler driver is holding its mutex, so leave it to the pool worker.
+ */
+static int pool_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	if (sc->nr_to_scan && pool_count) {
+		if (!mutex_trylock(&ops->mtx))
+			return -1;
+		pool_flush = true;
+		mutex_unlock(&ops->mtx);
+
+		cancel_delayed_work(&pool_work);
+		schedule_delayed_work(&pool_work, 0);
+	}
+	return pool_count;
+}
+
+/* free all pooled blocks now; returns whether there were any */
+static bool pool_flush_all(void)
+{
+	if (!pool_count)
+		return false;
+
+	cancel_delayed_work_sync(&pool_work);
+	mutex_lock(&ops->mtx);
+	pool_flush = true;
+	mutex_unlock(&ops->mtx);
+	pool_worker(NULL);
+	return true;
+}
+
+static struct shrinker pool_shrinker = {
+	.shrink = pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
 
 /*
  *  security_info handling methods
@@ -77,6 +176,7 @@ struct security_info *__get_si(int token, bool kernel,
 	si->kernel = kernel;
 	INIT_LIST_HEAD(&si->groups);
 	INIT_LIST_HEAD(&si->bufs);
+	INIT_LIST_HEAD(&si->pool);
 	list_add(&si->list, &procs);
 done:
 	/* increment reference count */
@@ -96,6 +196,7 @@ done:
 void _m_free_security_info(struct security_info *si)
 {
 	struct gid_info *gi, *gi_;
+	struct pool_info *pi, *pi_;
 #ifdef CONFIG_TILER_ENABLE_USERSPACE
 	struct __buf_info *_b = NULL, *_b_ = NULL;
 
@@ -108,6 +209,13 @@ void _m_free_security_info(struct security_info *si)
 #endif
 	BUG_ON(!list_empty(&si->bufs));
 
+	/* forget pooled blocks, they are freed with their group */
+	list_for_each_entry_safe(pi, pi_, &si->pool, by_sid) {
+		list_del(&pi->by_sid);
+		pool_count--;
+		kfree(pi);
+	}
+
 	/* free all allocated blocks, and remove unreferenced ones */
 	list_for_each_entry_safe(gi, gi_, &si->groups, by_sid)
 		ops->destroy_group(gi);
@@ -141,6 +249,15 @@ void tiler_iface_init(struct tiler_ops *tiler)
 	security = true;
 #endif
 	INIT_LIST_HEAD(&procs);
+	BLOCKING_INIT_NOTIFIER_HEAD(&notifier);
+	register_shrinker(&pool_shrinker);
+}
+
+/* stop the pool worker before the processes are destroyed */
+void tiler_iface_exit(void)
+{
+	unregister_shrinker(&pool_shrinker);
+	cancel_delayed_work_sync(&pool_work);
 }
 
 /*
@@ -169,6 +286,22 @@ u32 tiler_virt2phys(u32 usr)
 }
 EXPORT_SYMBOL(tiler_virt2phys);
 
+s32 tiler_reg_notifier(struct notifier_block *nb)
+{
+	if (!nb)
+		return -EINVAL;
+	return blocking_notifier_chain_register(&notifier, nb);
+}
+EXPORT_SYMBOL(tiler_reg_notifier);
+
+s32 tiler_unreg_notifier(struct notifier_block *nb)
+{
+	if (!nb)
+		return -EINVAL;
+	return blocking_notifier_chain_unregister(&notifier, nb);
+}
+EXPORT_SYMBOL(tiler_unreg_notifier);
+
 void tiler_reservex(u32 n, enum tiler_fmt fmt, u32 width, u32 height,
 		   u32 gid, pid_t pid)
 {
@@ -342,3 +475,82 @@ void tiler_free(struct tiler_block_t *blk)
 	blk->phys = blk->id = 0;
 }
 EXPORT_SYMBOL(tiler_free);
+
+s32 tiler_pool_allocx(struct tiler_block_t *blk, enum tiler_fmt fmt,
+				u32 gid, pid_t pid)
+{
+	struct pool_info *pi;
+	struct security_info *si;
+	s32 res;
+
+	BUG_ON(!blk || blk->phys);
+
+	si = __get_si(pid, true, SECURE_BY_PID);
+	if (!si)
+		return -ENOMEM;
+
+	/* reuse the most recently pooled matching block */
+	mutex_lock(&ops->mtx);
+	list_for_each_entry(pi, &si->pool, by_sid) {
+		if (pi->fmt == fmt && pi->gid == gid &&
+		    pi->blk.width == blk->width &&
+		    pi->blk.height == blk->height &&
+		    pi->blk.key == blk->key) {
+			list_del(&pi->by_sid);
+			pool_count--;
+			mutex_unlock(&ops->mtx);
+
+			*blk = pi->blk;
+			kfree(pi);
+			return 0;
+		}
+	}
+	mutex_unlock(&ops->mtx);
+
+	/* pooled blocks of any process may be what keeps the block from fitting */
+	res = tiler_allocx(blk, fmt, gid, pid);
+	if (res && pool_flush_all())
+		res = tiler_allocx(blk, fmt, gid, pid);
+	return res;
+}
+EXPORT_SYMBOL(tiler_pool_allocx);
+
+s32 tiler_pool_alloc(struct tiler_block_t *blk, enum tiler_fmt fmt)
+{
+	return tiler_pool_allocx(blk, fmt, 0, current->tgid);
+}
+EXPORT_SYMBOL(tiler_pool_alloc);
+
+void tiler_pool_freex(struct tiler_block_t *blk, u32 gid, pid_t pid)
+{
+	struct pool_info *pi = NULL;
+	struct security_info *si;
+
+	si = __get_si(pid, true, SECURE_BY_PID);
+	if (si && pool_age && blk->phys)
+		pi = kmalloc(sizeof(*pi), GFP_KERNEL);
+	if (!pi) {
+		tiler_free(blk);
+		return;
+	}
+
+	pi->blk = *blk;
+	pi->fmt = tiler_fmt(blk->phys);
+	pi->gid = gid;
+	pi->freed = jiffies;
+
+	mutex_lock(&ops->mtx);
+	list_add(&pi->by_sid, &si->pool);
+	if (!pool_count++)
+		schedule_delayed_work(&pool_work, msecs_to_jiffies(pool_age));
+	mutex_unlock(&ops->mtx);
+
+	blk->phys = blk->id = 0;
+}
+EXPORT_SYMBOL(tiler_pool_freex);
+
+void tiler_pool_free(struct tiler_block_t *blk)
+{
+	tiler_pool_freex(blk, 0, current->tgid);
+}
+EXPORT_SYMBOL(tiler_pool_free);
@@ -40,17 +40,6 @@ MODULE_PARM_DESC(offset_lookup,
 	"Allow looking up a buffer by offset - This is a security risk");
 
 static struct tiler_ops *ops;	/* shared methods and variables */
-static struct blocking_notifier_head notifier;	/* notifier for events */
-
-/*
- *  Event notification methods
- *  ==========================================================================
- */
-
-s32 tiler_notify_event(int event, void *data)
-{
-	return blocking_notifier_call_chain(&notifier, event, data);
-}
 
 /*
  *  Buffer handling methods
@@ -515,22 +504,4 @@ void tiler_ioctl_init(struct tiler_ops *tiler)
 #ifdef CONFIG_TILER_SECURE
 	offset_lookup = ssptr_lookup = false;
 #endif
-	BLOCKING_INIT_NOTIFIER_HEAD(&notifier);
-}
-
-
-s32 tiler_reg_notifier(struct notifier_block *nb)
-{
-	if (!nb)
-		return -EINVAL;
-	return blocking_notifier_chain_register(&notifier, nb);
-}
-EXPORT_SYMBOL(tiler_reg_notifier);
-
-s32 tiler_unreg_notifier(struct notifier_block *nb)
-{
-	if (!nb)
-		return -EINVAL;
-	return blocking_notifier_chain_unregister(&notifier, nb);
 }
-EXPORT_SYMBOL(tiler_unreg_notifier);
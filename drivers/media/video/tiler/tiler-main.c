@@ -33,15 +33,22 @@
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/debugfs.h>
+#include <linux/workqueue.h>
+#include <linux/sort.h>
 
 #include <mach/dmm.h>
 #include "tmm.h"
 #include "_tiler.h"
+#ifdef CONFIG_TILER_TCM_BITA
+#include "tcm/tcm-bita.h"		/* TCM algorithm */
+#else
 #include "tcm/tcm-sita.h"		/* TCM algorithm */
+#endif
 
 static bool ssptr_id = CONFIG_TILER_SSPTR_ID;
 static uint granularity = CONFIG_TILER_GRANULARITY;
 static uint tiler_alloc_debug;
+static uint defrag = 10;
 
 /*
  * We can only change ssptr_id if there are no blocks allocated, so that
@@ -54,6 +61,8 @@ module_param_named(grain, granularity, uint, 0644);
 MODULE_PARM_DESC(grain, "Granularity (bytes)");
 module_param_named(alloc_debug, tiler_alloc_debug, uint, 0644);
 MODULE_PARM_DESC(alloc_debug, "Allocation debug flag");
+module_param(defrag, uint, 0644);
+MODULE_PARM_DESC(defrag, "Free container % to compact at (0: never)");
 
 static struct dentry *dbgfs;
 static struct dentry *dbg_map;
@@ -79,38 +88,103 @@ static struct tmm *tmm[TILER_FORMATS];
 static u32 *dmac_va;
 static dma_addr_t dmac_pa;
 static DEFINE_MUTEX(dmac_mtx);
+static struct {
+	u32 chains;		/* descriptor chains sent to the PAT */
+	u32 areas;		/* areas refilled by them */
+	u64 total_ns;		/* time spent refilling */
+	u64 max_ns;		/* longest refill */
+} refill_stats;			/* protected by dmac_mtx */
 static dev_t dev;
+static bool defrag_pending;		/* compaction could not help yet */
 
 /*
  *  TMM connectors
  *  ==========================================================================
  */
-/* wrapper around tmm_pin */
-static s32 pin_mem_to_area(struct tmm *tmm, struct tcm_area *area, u32 *ptr)
+/*
+ * PAT refills are collected into a descriptor chain, so that the DMM is
+ * waited for once per chain instead of once per area.  The page lists are
+ * laid out one after the other in the coherent buffer.
+ */
+struct refill {
+	struct tmm *tmm;
+	u32 n;				/* number of areas */
+	u32 used;			/* entries used in dmac_va */
+	struct pat_area area[TMM_CHAIN_MAX];
+	u32 data[TMM_CHAIN_MAX];	/* page list of each area */
+};
+
+/* (must have dmac_mtx) refill the collected areas */
+static s32 refill_flush(struct refill *r)
 {
-	s32 res = 0;
-	struct pat_area p_area = {0};
-	struct tcm_area slice, area_s;
+	ktime_t start;
+	u64 ns;
+	s32 res;
+
+	if (!r->n)
+		return 0;
 
 	/* Ensure the data reaches to main memory before PAT refill */
 	wmb();
 
-	mutex_lock(&dmac_mtx);
+	start = ktime_get();
+	res = tmm_pin_chain(r->tmm, r->n, r->area, r->data);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	refill_stats.chains++;
+	refill_stats.areas += r->n;
+	refill_stats.total_ns += ns;
+	refill_stats.max_ns = max(refill_stats.max_ns, ns);
+
+	r->n = r->used = 0;
+	return res ? -EFAULT : 0;
+}
+
+/* (must have dmac_mtx) add an area to a refill, flushing it when full */
+static s32 refill_add(struct refill *r, struct tmm *tmm, struct tcm_area *area,
+									u32 *ptr)
+{
+	s32 res = 0;
+	struct pat_area p_area = {0};
+	struct tcm_area slice, area_s;
+	u32 n;
+
 	tcm_for_each_slice(slice, *area, area_s) {
 		p_area.x0 = slice.p0.x;
 		p_area.y0 = slice.p0.y;
 		p_area.x1 = slice.p1.x;
 		p_area.y1 = slice.p1.y;
+		n = tcm_sizeof(slice);
 
-		memcpy(dmac_va, ptr, sizeof(*ptr) * tcm_sizeof(slice));
-		ptr += tcm_sizeof(slice);
-
-		/* pin memory into DMM */
-		if (tmm_pin(tmm, p_area, dmac_pa)) {
+		if (r->n && (r->tmm != tmm || r->n == TMM_CHAIN_MAX ||
+			     r->used + n > tiler.width * tiler.height) &&
+		    refill_flush(r))
 			res = -EFAULT;
-			break;
-		}
+
+		r->tmm = tmm;
+		r->area[r->n] = p_area;
+		r->data[r->n++] = dmac_pa + r->used * sizeof(*dmac_va);
+
+		memcpy(dmac_va + r->used, ptr, sizeof(*ptr) * n);
+		ptr += n;
+
+		/* page lists must be 16-byte aligned */
+		r->used += ALIGN(n, 4);
 	}
+
+	return res;
+}
+
+/* wrapper around tmm_pin */
+static s32 pin_mem_to_area(struct tmm *tmm, struct tcm_area *area, u32 *ptr)
+{
+	struct refill r = {0};
+	s32 res;
+
+	mutex_lock(&dmac_mtx);
+	res = refill_add(&r, tmm, area, ptr);
+	if (refill_flush(&r))
+		res = -EFAULT;
 	mutex_unlock(&dmac_mtx);
 
 	return res;
@@ -309,6 +383,20 @@ error:
 	kfree(global_map);
 }
 
+static void debug_refill_stats(struct seq_file *s, u32 arg)
+{
+	mutex_lock(&dmac_mtx);
+	seq_printf(s, "chains: %u\nareas: %u\ntotal: %llu us\nmax: %llu us\n",
+		   refill_stats.chains, refill_stats.areas,
+		   div_u64(refill_stats.total_ns, NSEC_PER_USEC),
+		   div_u64(refill_stats.max_ns, NSEC_PER_USEC));
+	mutex_unlock(&dmac_mtx);
+}
+
+const struct tiler_debugfs_data debugfs_refill = {
+	"refill", debug_refill_stats, 0
+};
+
 const struct tiler_debugfs_data debugfs_maps[] = {
 	{ "1x1", debug_allocation_map, 0x0101 },
 	{ "2x1", debug_allocation_map, 0x0201 },
@@ -417,6 +505,268 @@ static void release_gi(struct gid_info *gi)
 	mutex_unlock(&mtx);
 }
 
+/*
+ *  Container compaction
+ *  ==========================================================================
+ */
+
+/* compaction candidate: a 2D area or a 1D block */
+struct compact_item {
+	u32 key;			/* order of moving */
+	struct area_info *ai;		/* 2D area, or */
+	struct mem_info *mi;		/* 1D block */
+};
+
+/* (must have mutex) check if a failed reservation was due to fragmentation */
+static bool _m_fragmented(struct tcm *tcm, u32 slots)
+{
+	u32 size = tcm->width * tcm->height;
+	u32 avail = size - atomic_read(&tcm->used);
+
+	return defrag && avail >= slots && avail * 100 >= size * defrag;
+}
+
+/* (must have mutex) check if a block can be moved */
+static bool _m_can_move(struct mem_info *mi)
+{
+	/* reserved blocks have no address handed out yet */
+	if (!mi->alloced)
+		return !mi->refs;
+
+	/* others only if their owner allows it, and it is the only user */
+	return mi->movable && mi->refs == 1;
+}
+
+/* (must have mutex) update and repin a block that was moved to mi->area */
+static void _m_move_blk(struct mem_info *mi, struct tcm_area *from)
+{
+	enum tiler_fmt fmt;
+	const struct tiler_geom *g;
+	struct tiler_block_moved moved = {
+		.block = mi,
+		.old_ssptr = mi->blk.phys,
+	};
+	struct tcm_area area = mi->area;
+
+	/* reserved blocks get their address when allocated */
+	if (!mi->alloced)
+		return;
+
+	fmt = tiler_fmt(mi->blk.phys);
+	g = tiler.geom(fmt);
+
+	/* keep the offset of the block within its first slot */
+	moved.new_ssptr = mi->blk.phys -
+		tiler.addr(fmt, from->p0.x * g->slot_w, from->p0.y * g->slot_h) +
+		tiler.addr(fmt, area.p0.x * g->slot_w, area.p0.y * g->slot_h);
+	mi->blk.phys = moved.new_ssptr;
+	if (ssptr_id)
+		mi->blk.id = mi->blk.phys;
+
+	if (mi->pa.num_pg) {
+		/* only refill available pages for 1D */
+		if (fmt == TILFMT_PAGE)
+			tcm_1d_limit(&area, mi->pa.num_pg);
+		if (pin_mem_to_area(tmm[fmt], &area, mi->pa.mem))
+			printk(KERN_ERR "tiler: could not repin moved block %08x\n",
+								mi->blk.phys);
+	}
+
+	if (tiler_alloc_debug & 1)
+		printk(KERN_ERR "(>%s %08x => %08x)\n",
+				mi->area.is2d ? "2d" : "1d",
+				moved.old_ssptr, moved.new_ssptr);
+
+	tiler_notify_event(TILER_BLOCK_MOVED, &moved);
+}
+
+/* (must have mutex) move a 2D area with all its blocks to the best fit */
+static bool _m_move_area(struct area_info *ai)
+{
+	struct tcm_area old = ai->area, from;
+	struct mem_info *mi;
+
+	list_for_each_entry(mi, &ai->blocks, by_area)
+		if (!_m_can_move(mi))
+			return false;
+
+	/*
+	 * The old place is free once released, so the area should always fit
+	 * again, at worst in the same place.  If it does not, leave it where it
+	 * is.
+	 */
+	tcm_free(&ai->area);
+	if (WARN_ON(tcm_reserve_2d(old.tcm, tcm_awidth(old), tcm_aheight(old),
+							ai->align, &ai->area))) {
+		ai->area = old;
+		return false;
+	}
+	if (ai->area.p0.x == old.p0.x && ai->area.p0.y == old.p0.y)
+		return false;
+
+	/* unpin all blocks first, as the new area may overlap the old one */
+	list_for_each_entry(mi, &ai->blocks, by_area)
+		if (mi->pa.num_pg)
+			unpin_mem_from_area(tmm[tiler_fmt(mi->blk.phys)],
+								&mi->area);
+
+	/* blocks keep their offset (and thus alignment) within the area */
+	list_for_each_entry(mi, &ai->blocks, by_area) {
+		from = mi->area;
+		mi->area.p0.x = from.p0.x - old.p0.x + ai->area.p0.x;
+		mi->area.p1.x = from.p1.x - old.p0.x + ai->area.p0.x;
+		mi->area.p0.y = ai->area.p0.y;
+		mi->area.p1.y = ai->area.p1.y;
+		_m_move_blk(mi, &from);
+	}
+	return true;
+}
+
+/* (must have mutex) move a 1D block to the best fit */
+static bool _m_move_1d(struct mem_info *mi)
+{
+	struct tcm_area old = mi->area, area;
+
+	if (!_m_can_move(mi))
+		return false;
+
+	/* the block should always fit again, at worst in the same place */
+	tcm_free(&mi->area);
+	if (WARN_ON(tcm_reserve_1d(old.tcm, tcm_sizeof(old), &mi->area))) {
+		mi->area = old;
+		return false;
+	}
+	if (mi->area.p0.x == old.p0.x && mi->area.p0.y == old.p0.y)
+		return false;
+
+	if (mi->pa.num_pg) {
+		area = old;
+		tcm_1d_limit(&area, mi->pa.num_pg);
+		unpin_mem_from_area(tmm[TILFMT_PAGE], &area);
+	}
+	_m_move_blk(mi, &old);
+	return true;
+}
+
+static int compact_item_cmp(const void *a, const void *b)
+{
+	const struct compact_item *ia = a, *ib = b;
+
+	return ia->key < ib->key ? -1 : ia->key > ib->key;
+}
+
+/*
+ * (must have mutex) compact a container
+ *
+ * The container managers fill 2D areas from the top and 1D areas from the
+ * bottom, so re-reserving 2D areas from the top and 1D blocks from the
+ * bottom moves each of them towards its end, and joins the free space in
+ * the middle.  Only areas with allocated blocks are considered.
+ */
+static void _m_compact(struct tcm *tcm)
+{
+	u32 size = tcm->width * tcm->height;
+	struct compact_item *items;
+	struct mem_info *mi;
+	int i, n = 0, moved = 0;
+
+	list_for_each_entry(mi, &blocks, global)
+		n++;
+	items = kmalloc(n * sizeof(*items), GFP_KERNEL);
+	if (!items)
+		return;
+
+	n = 0;
+	list_for_each_entry(mi, &blocks, global) {
+		if (mi->area.tcm != tcm)
+			continue;
+
+		if (mi->area.is2d) {
+			/* add each area only once */
+			for (i = 0; i < n && items[i].ai != mi->parent; i++)
+				;
+			if (i < n)
+				continue;
+
+			items[n].ai = mi->parent;
+			items[n].mi = NULL;
+			items[n].key = items[n].ai->area.p0.y * tcm->width +
+						items[n].ai->area.p0.x;
+		} else {
+			/* 1D blocks go after all 2D areas */
+			items[n].ai = NULL;
+			items[n].mi = mi;
+			items[n].key = 2 * size - 1 -
+				(mi->area.p1.y * tcm->width + mi->area.p1.x);
+		}
+		n++;
+	}
+
+	sort(items, n, sizeof(*items), compact_item_cmp, NULL);
+
+	for (i = 0; i < n; i++)
+		moved += items[i].ai ? _m_move_area(items[i].ai) :
+				       _m_move_1d(items[i].mi);
+	kfree(items);
+
+	if (tiler_alloc_debug & 1)
+		printk(KERN_ERR "(compacted %d of %d areas)\n", moved, n);
+}
+
+static void defrag_worker(struct work_struct *work)
+{
+	int i, j;
+
+	mutex_lock(&mtx);
+	defrag_pending = false;
+
+	/* compact shared containers only once */
+	for (i = TILFMT_MIN; i <= TILFMT_MAX; i++) {
+		for (j = TILFMT_MIN; j < i && tcm[j] != tcm[i]; j++)
+			;
+		if (j == i && tcm[i])
+			_m_compact(tcm[i]);
+	}
+	mutex_unlock(&mtx);
+}
+static DECLARE_DELAYED_WORK(defrag_work, defrag_worker);
+
+/* (must have mutex) retry a failed compaction once it may help */
+static void _m_defrag_later(struct tcm *tcm)
+{
+	if (defrag_pending && tcm && _m_fragmented(tcm, 0))
+		schedule_delayed_work(&defrag_work, HZ);
+}
+
+/* (must have mutex) reserve a 2D area, compacting the container if needed */
+static s32 _m_reserve_2d(struct tcm *tcm, u16 width, u16 height, u16 align,
+							struct tcm_area *area)
+{
+	s32 res = tcm_reserve_2d(tcm, width, height, align, area);
+
+	if (res && _m_fragmented(tcm, width * height)) {
+		_m_compact(tcm);
+		res = tcm_reserve_2d(tcm, width, height, align, area);
+		if (res)
+			defrag_pending = true;
+	}
+	return res;
+}
+
+/* (must have mutex) reserve a 1D area, compacting the container if needed */
+static s32 _m_reserve_1d(struct tcm *tcm, u32 slots, struct tcm_area *area)
+{
+	s32 res = tcm_reserve_1d(tcm, slots, area);
+
+	if (res && _m_fragmented(tcm, slots)) {
+		_m_compact(tcm);
+		res = tcm_reserve_1d(tcm, slots, area);
+		if (res)
+			defrag_pending = true;
+	}
+	return res;
+}
+
 /*
  *  Area handling methods
  *  ==========================================================================
@@ -437,16 +787,18 @@ static struct area_info *area_new_m(enum tiler_fmt fmt, u16 width, u16 height,
 	INIT_LIST_HEAD(&ai->blocks);
 
 	/* reserve an allocation area */
-	if (tcm_reserve_2d(tcm[fmt], width, height, align, &ai->area)) {
+	mutex_lock(&mtx);
+	if (_m_reserve_2d(tcm[fmt], width, height, align, &ai->area)) {
+		mutex_unlock(&mtx);
 		kfree(ai);
 		return NULL;
 	}
 
 	ai->gi = gi;
+	ai->align = align;
 	if (alloc_flags & FLAGS_ALLOC_NO_COLOCATE)
 		ai->allowed_modes |= 1 << fmt;
 
-	mutex_lock(&mtx);
 	list_add_tail(&ai->by_gid, &gi->areas);
 	return ai;
 }
@@ -875,6 +1227,7 @@ static void _m_unpin(struct mem_info *mi)
 static s32 _m_free(struct mem_info *mi)
 {
 	struct area_info *ai = NULL;
+	struct tcm *container = mi->area.tcm;
 	s32 res = 0;
 
 	_m_unpin(mi);
@@ -923,6 +1276,7 @@ static s32 _m_free(struct mem_info *mi)
 	}
 
 	kfree(mi);
+	_m_defrag_later(container);
 	return res;
 }
 
@@ -1186,7 +1540,9 @@ static struct mem_info *alloc_area(enum tiler_fmt fmt, u32 width, u32 height,
 			return NULL;
 		memset(mi, 0x0, sizeof(*mi));
 
-		if (tcm_reserve_1d(tcm[fmt], x * y, &mi->area)) {
+		mutex_lock(&mtx);
+		if (_m_reserve_1d(tcm[fmt], x * y, &mi->area)) {
+			mutex_unlock(&mtx);
 			kfree(mi);
 			return NULL;
 		}
@@ -1196,7 +1552,6 @@ static struct mem_info *alloc_area(enum tiler_fmt fmt, u32 width, u32 height,
 						mi->area.p0.x, mi->area.p0.y,
 						mi->area.p1.x, mi->area.p1.y);
 
-		mutex_lock(&mtx);
 		mi->parent = gi;
 		list_add(&mi->by_area, &gi->onedim);
 	} else {
@@ -1554,22 +1909,32 @@ static int tiler_resume(struct device *pdev)
 {
 	struct mem_info *mi;
 	struct pat_area area = {0};
+	struct tcm_area pinned;
+	struct refill r = {0};
 
 	/* clear out PAT entries and set dummy page */
 	area.x1 = tiler.width - 1;
 	area.y1 = tiler.height - 1;
 	mutex_lock(&dmac_mtx);
 	tmm_unpin(tmm[TILFMT_8BIT], area);
-	mutex_unlock(&dmac_mtx);
 
-	/* iterate over all the blocks and refresh the PAT entries */
+	/* iterate over all the blocks and refresh the PAT entries in chains */
 	list_for_each_entry(mi, &blocks, global) {
-		if (mi->pa.mem)
-			if (pin_mem_to_area(tmm[tiler_fmt(mi->blk.phys)],
-						&mi->area, mi->pa.mem))
-				printk(KERN_ERR "Failed PAT restore - %08x\n",
-					mi->blk.phys);
+		if (!mi->pa.mem)
+			continue;
+
+		/* only available pages were pinned for 1D */
+		pinned = mi->area;
+		if (tiler_fmt(mi->blk.phys) == TILFMT_PAGE)
+			tcm_1d_limit(&pinned, mi->pa.num_pg);
+		if (refill_add(&r, tmm[tiler_fmt(mi->blk.phys)], &pinned,
+								mi->pa.mem))
+			printk(KERN_ERR "Failed PAT restore - %08x\n",
+				mi->blk.phys);
 	}
+	if (refill_flush(&r))
+		printk(KERN_ERR "Failed PAT restore\n");
+	mutex_unlock(&dmac_mtx);
 
 	return 0;
 }
@@ -1594,7 +1959,7 @@ static s32 __init tiler_init(void)
 	s32 r = -1;
 	struct device *device = NULL;
 	struct tcm_pt div_pt;
-	struct tcm *sita = NULL;
+	struct tcm *container = NULL;
 	struct tmm *tmm_pat = NULL;
 	struct pat_area area = {0};
 
@@ -1643,12 +2008,16 @@ static s32 __init tiler_init(void)
 	/* Allocate tiler container manager (we share 1 on OMAP4) */
 	div_pt.x = tiler.width;   /* hardcoded default */
 	div_pt.y = (3 * tiler.height) / 4;
-	sita = sita_init(tiler.width, tiler.height, (void *)&div_pt);
+#ifdef CONFIG_TILER_TCM_BITA
+	container = bita_init(tiler.width, tiler.height, (void *)&div_pt);
+#else
+	container = sita_init(tiler.width, tiler.height, (void *)&div_pt);
+#endif
 
-	tcm[TILFMT_8BIT]  = sita;
-	tcm[TILFMT_16BIT] = sita;
-	tcm[TILFMT_32BIT] = sita;
-	tcm[TILFMT_PAGE]  = sita;
+	tcm[TILFMT_8BIT]  = container;
+	tcm[TILFMT_16BIT] = container;
+	tcm[TILFMT_32BIT] = container;
+	tcm[TILFMT_PAGE]  = container;
 
 	/* Allocate tiler memory manager (must have 1 unique TMM per TCM ) */
 	tmm_pat = tmm_pat_init(0, dmac_va, dmac_pa);
@@ -1666,7 +2035,7 @@ static s32 __init tiler_init(void)
 	tiler.nv12_packed = tcm[TILFMT_8BIT] == tcm[TILFMT_16BIT];
 #endif
 
-	if (!sita || !tmm_pat) {
+	if (!container || !tmm_pat) {
 		r = -ENOMEM;
 		goto error;
 	}
@@ -1716,8 +2085,11 @@ static s32 __init tiler_init(void)
 	dbgfs = debugfs_create_dir("tiler", NULL);
 	if (IS_ERR_OR_NULL(dbgfs))
 		dev_warn(device, "failed to create debug files.\n");
-	else
+	else {
+		debugfs_create_file(debugfs_refill.name, S_IRUGO, dbgfs,
+				(void *) &debugfs_refill, &tiler_debug_fops);
 		dbg_map = debugfs_create_dir("map", dbgfs);
+	}
 	if (!IS_ERR_OR_NULL(dbg_map)) {
 		int i;
 		for (i = 0; i < ARRAY_SIZE(debugfs_maps); i++)
@@ -1732,7 +2104,7 @@ error:
 #ifdef CONFIG_TILER_ENABLE_USERSPACE
 		kfree(tiler_device);
 #endif
-		tcm_deinit(sita);
+		tcm_deinit(container);
 		tmm_deinit(tmm_pat);
 		dma_free_coherent(NULL, tiler.width * tiler.height *
 					sizeof(*dmac_va), dmac_va, dmac_pa);
@@ -1745,6 +2117,8 @@ static void __exit tiler_exit(void)
 {
 	int i, j;
 
+	tiler_iface_exit();
+
 	mutex_lock(&mtx);
 
 	debugfs_remove_recursive(dbgfs);
@@ -1759,6 +2133,9 @@ static void __exit tiler_exit(void)
 
 	mutex_unlock(&mtx);
 
+	/* freeing the blocks may have scheduled a compaction */
+	cancel_delayed_work_sync(&defrag_work);
+
 	dma_free_coherent(NULL, tiler.width * tiler.height * sizeof(*dmac_va),
 							dmac_va, dmac_pa);
 
@@ -1861,6 +2238,16 @@ void tiler_unpin_block(tiler_blk_handle block)
 }
 EXPORT_SYMBOL(tiler_unpin_block);
 
+void tiler_set_block_movable(tiler_blk_handle block, bool movable)
+{
+	mutex_lock(&mtx);
+	block->movable = movable;
+	if (movable)
+		_m_defrag_later(block->area.tcm);
+	mutex_unlock(&mtx);
+}
+EXPORT_SYMBOL(tiler_set_block_movable);
+
 s32 tiler_memsize(enum tiler_fmt fmt, u32 width, u32 height, u32 *alloc_pages,
 		  u32 *virt_pages)
 {
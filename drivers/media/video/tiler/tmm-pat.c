@@ -23,6 +23,7 @@
 #include <linux/mutex.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/dma-mapping.h>
 
 #include "tmm.h"
 
@@ -65,6 +66,8 @@ struct dmm_mem {
 	u32 dmac_pa;		/* phys.addr of coherent memory */
 	struct page *dummy_pg;	/* dummy page */
 	u32 dummy_pa;		/* phys.addr of dummy page */
+	struct pat *chain;	/* coherent memory for descriptor chains */
+	dma_addr_t chain_pa;	/* phys.addr of descriptor chains */
 };
 
 /* read mem values for a param */
@@ -168,6 +171,8 @@ static void tmm_pat_deinit(struct tmm *tmm)
 		free_page_cache();
 
 	__free_page(pvt->dummy_pg);
+	dma_free_coherent(NULL, TMM_CHAIN_MAX * sizeof(*pvt->chain),
+						pvt->chain, pvt->chain_pa);
 
 	mutex_unlock(&mtx);
 }
@@ -268,6 +273,34 @@ static s32 tmm_pat_pin(struct tmm *tmm, struct pat_area area, u32 page_pa)
 	return dmm_pat_refill(pvt->dmm, &pat_desc, MANUAL);
 }
 
+static s32 tmm_pat_pin_chain(struct tmm *tmm, u32 n, struct pat_area *area,
+								u32 *page_pa)
+{
+	struct dmm_mem *pvt = (struct dmm_mem *) tmm->pvt;
+	struct pat *pat_desc = pvt->chain;
+	u32 i;
+
+	if (!n || n > TMM_CHAIN_MAX)
+		return -EINVAL;
+
+	/* descriptors are linked by their physical address */
+	memset(pat_desc, 0, n * sizeof(*pat_desc));
+	for (i = 0; i < n; i++) {
+		pat_desc[i].ctrl.start = 1;
+		pat_desc[i].area = area[i];
+		if (i + 1 < n)
+			pat_desc[i].next = (struct pat *) (pvt->chain_pa +
+						(i + 1) * sizeof(*pat_desc));
+
+		/* must be a 16-byte aligned physical address */
+		pat_desc[i].data = page_pa[i];
+	}
+
+	/* send pat descriptor chain to dmm driver */
+	wmb();
+	return dmm_pat_refill_chain(pvt->dmm, pvt->chain_pa);
+}
+
 static void tmm_pat_unpin(struct tmm *tmm, struct pat_area area)
 {
 	u16 w = (u8) area.x1 - (u8) area.x0;
@@ -290,10 +323,14 @@ struct tmm *tmm_pat_init(u32 pat_id, u32 *dmac_va, u32 dmac_pa)
 	if (dmm)
 		tmm = kmalloc(sizeof(*tmm), GFP_KERNEL);
 	if (tmm)
-		pvt = kmalloc(sizeof(*pvt), GFP_KERNEL);
+		pvt = kzalloc(sizeof(*pvt), GFP_KERNEL);
 	if (pvt)
 		pvt->dummy_pg = alloc_page(GFP_KERNEL | GFP_DMA);
-	if (pvt->dummy_pg) {
+	if (pvt && pvt->dummy_pg)
+		pvt->chain = dma_alloc_coherent(NULL,
+				TMM_CHAIN_MAX * sizeof(*pvt->chain),
+				&pvt->chain_pa, GFP_KERNEL);
+	if (pvt && pvt->chain) {
 		/* private data */
 		pvt->dmm = dmm;
 		pvt->dmac_pa = dmac_pa;
@@ -313,11 +350,14 @@ struct tmm *tmm_pat_init(u32 pat_id, u32 *dmac_va, u32 dmac_pa)
 		tmm->get = tmm_pat_get_pages;
 		tmm->free = tmm_pat_free_pages;
 		tmm->pin = tmm_pat_pin;
+		tmm->pin_chain = tmm_pat_pin_chain;
 		tmm->unpin = tmm_pat_unpin;
 
 		return tmm;
 	}
 
+	if (pvt && pvt->dummy_pg)
+		__free_page(pvt->dummy_pg);
 	kfree(pvt);
 	kfree(tmm);
 	dmm_pat_release(dmm);
@@ -40,6 +40,10 @@
 #define TMM_H
 
 #include <mach/dmm.h>
+
+/* maximum number of areas refilled in one tmm_pin_chain call */
+#define TMM_CHAIN_MAX	32
+
 /**
  * TMM interface
  */
@@ -50,6 +54,8 @@ struct tmm {
 	u32 *(*get)	(struct tmm *tmm, u32 num_pages);
 	void (*free)	(struct tmm *tmm, u32 *pages);
 	s32  (*pin)	(struct tmm *tmm, struct pat_area area, u32 page_pa);
+	s32  (*pin_chain) (struct tmm *tmm, u32 n, struct pat_area *area,
+								u32 *page_pa);
 	void (*unpin)	(struct tmm *tmm, struct pat_area area);
 	void (*deinit)	(struct tmm *tmm);
 };
@@ -90,6 +96,25 @@ s32 tmm_pin(struct tmm *tmm, struct pat_area area, u32 page_pa)
 	return -ENODEV;
 }
 
+/**
+ * Program the physical address translator for several areas at once.
+ * @param n       number of areas (at most TMM_CHAIN_MAX)
+ * @param area    PAT areas
+ * @param page_pa list of pages for each area
+ */
+static inline
+s32 tmm_pin_chain(struct tmm *tmm, u32 n, struct pat_area *area, u32 *page_pa)
+{
+	s32 res = 0;
+
+	if (tmm && tmm->pin_chain && tmm->pvt)
+		return tmm->pin_chain(tmm, n, area, page_pa);
+
+	while (n-- && !res)
+		res = tmm_pin(tmm, *area++, *page_pa++);
+	return res;
+}
+
 /**
  * Clears the physical address translator.
  * @param area PAT area
@@ -32,6 +32,7 @@ enum {
 	BINDER_TYPE_HANDLE	= B_PACK_CHARS('s', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_WEAK_HANDLE	= B_PACK_CHARS('w', 'h', '*', B_TYPE_LARGE),
 	BINDER_TYPE_FD		= B_PACK_CHARS('f', 'd', '*', B_TYPE_LARGE),
+	BINDER_TYPE_PAGES	= B_PACK_CHARS('p', 'g', '*', B_TYPE_LARGE),
 };
 
 enum {
@@ -61,6 +62,23 @@ struct flat_binder_object {
 	void			*cookie;
 };
 
+/*
+ * A BINDER_TYPE_PAGES object describes a region of the sender's address
+ * space, typically part of an ashmem mapping, that is handed to the target
+ * without copying.  The pages backing the region are mapped read-only into
+ * the target's binder buffer and stay pinned until the buffer is freed;
+ * the driver rewrites 'buffer' to the address of the region as seen by the
+ * target.  Pages that cannot be shared (e.g. anonymous memory) are copied
+ * instead.  The transaction must carry TF_PAGES so that the driver can
+ * reserve room for the regions.  It has the size of a flat_binder_object.
+ */
+struct binder_pages_object {
+	unsigned long		type;
+	unsigned long		flags;
+	void			*buffer;
+	size_t			length;
+};
+
 /*
  * On 64-bit platforms where user code may run in 32-bits the driver must
  * translate the buffer (and local binder) addresses apropriately.
@@ -112,6 +130,7 @@ enum transaction_flags {
 	TF_ROOT_OBJECT	= 0x04,	/* contents are the component's root object */
 	TF_STATUS_CODE	= 0x08,	/* contents are a 32-bit status code */
 	TF_ACCEPT_FDS	= 0x10,	/* allow replies with file descriptors */
+	TF_PAGES	= 0x20,	/* contains binder_pages_object entries */
 };
 
 struct binder_transaction_data {
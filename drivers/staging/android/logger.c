@@ -21,6 +21,8 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
@@ -35,17 +37,21 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers never lock: they reserve space by advancing 'w_off' with cmpxchg,
+ * copy their entry in with preemption disabled and then commit it, in
+ * reservation order, by advancing hdr->commit.  Before overwriting the oldest
+ * entries a writer moves hdr->head past them, also with cmpxchg.  'mutex'
+ * only serialises readers and ioctls.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	struct mutex		mutex;	/* mutex protecting readers */
+	struct logger_mmap_header *hdr;	/* head and commit, mappable */
+	u32			w_off;	/* reserved write position */
 	size_t			size;	/* size of the log */
 };
 
@@ -57,8 +63,7 @@ struct logger_log {
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	u32			r_off;	/* current read position */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
 };
@@ -66,6 +71,15 @@ struct logger_reader {
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* logger_before - does position 'a' come before position 'b'? */
+#define logger_before(a, b)	((s32) ((a) - (b)) < 0)
+
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
+/* per-cpu staging area for payloads, filled with page faults disabled */
+static DEFINE_PER_CPU(char [LOGGER_ENTRY_MAX_PAYLOAD], logger_scratch);
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -90,39 +104,89 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_header - returns a pointer to the logger_entry header within
- * 'log' starting at offset 'off'. A temporary logger_entry 'scratch' must
- * be provided. Typically the return value will be a pointer within
- * 'logger->buf'.  However, a pointer to 'scratch' may be returned if
- * the log entry spans the end and beginning of the circular buffer.
+ * get_commit - returns the position past the newest committed entry.  The
+ * entries before it may be read once this returns.
+ */
+static inline u32 get_commit(struct logger_log *log)
+{
+	u32 commit = ACCESS_ONCE(log->hdr->commit);
+
+	smp_rmb();
+	return commit;
+}
+
+/*
+ * get_entry_header - copies the logger_entry header at position 'pos' of
+ * 'log' into 'entry', taking care of entries that span the end and
+ * beginning of the circular buffer.
  */
-static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
+static void get_entry_header(struct logger_log *log, u32 pos,
+			     struct logger_entry *entry)
 {
+	size_t off = logger_offset(pos);
 	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
-		memcpy(((void *) scratch) + len, log->buffer,
-			sizeof(struct logger_entry) - len);
-		return scratch;
-	}
 
-	return (struct logger_entry *) (log->buffer + off);
+	memcpy(entry, log->buffer + off, len);
+	if (len != sizeof(struct logger_entry))
+		memcpy((void *) entry + len, log->buffer,
+		       sizeof(struct logger_entry) - len);
+}
+
+/*
+ * entry_valid - checks, after the entry at 'pos' was copied out of the
+ * log, that no writer lapped it in the meantime.  Writers move the head
+ * past an entry before they overwrite it.
+ */
+static inline bool entry_valid(struct logger_log *log, u32 pos)
+{
+	smp_rmb();
+	return !logger_before(pos, ACCESS_ONCE(log->hdr->head));
+}
+
+/*
+ * fix_up_reader - "pull forward" a reader that was lapped by the writers to
+ * the oldest entry still in the log.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static void fix_up_reader(struct logger_log *log, struct logger_reader *reader)
+{
+	u32 head = ACCESS_ONCE(log->hdr->head);
+
+	if (logger_before(reader->r_off, head))
+		reader->r_off = head;
 }
 
 /*
- * get_entry_msg_len - Grabs the length of the message of the entry
- * starting from from 'off'.
+ * get_next_entry_by_uid - copies into 'entry' the header of the next entry
+ * 'reader' may read, skipping those written by other users if needed and
+ * fixing up the reader if it was lapped.  Returns false if there is none.
  *
  * Caller needs to hold log->mutex.
  */
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
+static bool get_next_entry_by_uid(struct logger_log *log,
+				  struct logger_reader *reader,
+				  struct logger_entry *entry)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	/*
+	 * The commit is re-read after each fix-up: a reader pulled forward
+	 * to the head may otherwise end up past a stale commit.
+	 */
+	fix_up_reader(log, reader);
+	while (logger_before(reader->r_off, get_commit(log))) {
+		get_entry_header(log, reader->r_off, entry);
+		if (!entry_valid(log, reader->r_off)) {
+			fix_up_reader(log, reader);
+			continue;
+		}
+
+		if (reader->r_all || entry->euid == current_euid())
+			return true;
 
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+		reader->r_off += sizeof(struct logger_entry) + entry->len;
+	}
+
+	return false;
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -158,18 +222,18 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log_to_user - reads exactly 'count' bytes of the entry 'entry'
+ * from 'log' into the user-space buffer 'buf'. Returns 'count' on success,
+ * or zero if the entry was overwritten while we copied it out.
  *
  * Caller must hold log->mutex.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
+				   struct logger_entry *entry,
 				   char __user *buf,
 				   size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
 	size_t len;
 	size_t msg_start;
 
@@ -177,7 +241,6 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * First, copy the header to userspace, using the version of
 	 * the header requested
 	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
 	if (copy_header_to_user(reader->r_ver, entry, buf))
 		return -EFAULT;
 
@@ -202,34 +265,12 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off +
-		sizeof(struct logger_entry) + count);
-
-	return count + get_user_hdr_len(reader->r_ver);
-}
-
-/*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
- */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
-{
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
-
-		entry = get_entry_header(log, off, &scratch);
-
-		if (entry->euid == euid)
-			return off;
+	if (!entry_valid(log, reader->r_off))
+		return 0;
 
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(off + next_len);
-	}
+	reader->r_off += sizeof(struct logger_entry) + count;
 
-	return off;
+	return count + get_user_hdr_len(reader->r_ver);
 }
 
 /*
@@ -249,6 +290,7 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry entry;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -257,7 +299,8 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
+		fix_up_reader(log, reader);
+		ret = !logger_before(reader->r_off, get_commit(log));
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -281,137 +324,138 @@ start:
 
 	mutex_lock(&log->mutex);
 
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
+	if (unlikely(!get_next_entry_by_uid(log, reader, &entry))) {
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + entry.len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(log, reader, &entry, buf, ret);
 
 out:
 	mutex_unlock(&log->mutex);
 
+	/* we were lapped while copying, start over from the new head */
+	if (unlikely(!ret))
+		goto start;
+
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
+ * fix_up_head - move the head, where new and lapped readers start, to the
+ * first entry at or after position 'pos'. The entries it skips are about to
+ * be overwritten.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void fix_up_head(struct logger_log *log, u32 pos)
 {
-	size_t count = 0;
+	struct logger_entry entry;
+	u32 head, new;
 
 	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
+		head = ACCESS_ONCE(log->hdr->head);
+		if (!logger_before(head, pos))
+			return;
+
+		/*
+		 * The entries we walk are committed but may be overwritten by
+		 * a writer that has already moved the head further; the
+		 * cmpxchg then fails and we start over.
+		 */
+		new = head;
+		do {
+			get_entry_header(log, new, &entry);
+			new += sizeof(struct logger_entry) + entry.len;
+		} while (logger_before(new, pos));
+	} while (cmpxchg(&log->hdr->head, head, new) != head);
 }
 
 /*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
+ * reserve_log - reserve 'len' bytes at the write head of 'log', moving the
+ * head past the entries they overwrite, and return their position.
+ *
+ * Must be called with preemption disabled, so that at most one entry per
+ * cpu is ever reserved and not yet committed.
  */
-static inline int clock_interval(size_t a, size_t b, size_t c)
+static u32 reserve_log(struct logger_log *log, size_t len)
 {
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
+	u32 old, pos = ACCESS_ONCE(log->w_off);
 
-	return 0;
+	do {
+		old = pos;
+		pos = cmpxchg(&log->w_off, old, old + len);
+	} while (pos != old);
+
+	fix_up_head(log, pos + len - log->size);
+
+	return pos;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * commit_log - publish the 'len' bytes reserved at 'pos' to readers, once
+ * every entry reserved before them was published.
  *
- * The caller needs to hold log->mutex.
+ * Must be called with preemption disabled.  Writers ahead of us do nothing
+ * but copy from kernel memory, so the wait is short.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void commit_log(struct logger_log *log, u32 pos, size_t len)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	while (ACCESS_ONCE(log->hdr->commit) != pos)
+		cpu_relax();
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	smp_mb();
+	log->hdr->commit = pos + len;
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'pos'
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, u32 pos, const void *buf,
+			 size_t count)
 {
+	size_t off = logger_offset(pos);
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * gather_from_user - copies the first 'count' bytes of the user-space
+ * vector 'iov' into 'buf'. Returns zero on success, -EFAULT on failure.
  *
- * Returns 'count' on success, negative error code on failure.
+ * With 'atomic' set the copy does not sleep and fails instead of faulting
+ * pages in; the vector was already checked by the VFS.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static int gather_from_user(char *buf, const struct iovec *iov,
+			    unsigned long nr_segs, size_t count, bool atomic)
 {
-	size_t len;
+	while (nr_segs-- > 0 && count) {
+		size_t len = min_t(size_t, iov->iov_len, count);
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+		if (atomic) {
+			if (__copy_from_user_inatomic(buf, iov->iov_base, len))
+				return -EFAULT;
+		} else if (copy_from_user(buf, iov->iov_base, len))
 			return -EFAULT;
 
-	sec_logger_update_buffer(log->buffer + log->w_off, count);
-
-	log->w_off = logger_offset(log->w_off + count);
+		iov++;
+		buf += len;
+		count -= len;
+	}
 
-	return count;
+	return 0;
 }
 
 /*
@@ -423,10 +467,12 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	char *payload, *buf = NULL;
+	size_t len;
+	u32 pos;
+	int ret;
 
 	now = current_kernel_time();
 
@@ -442,47 +488,55 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
+	 * Stage the payload first, so that nothing between reserving and
+	 * committing the entry can fault or sleep.  The per-cpu scratch
+	 * buffer covers the common case of resident user pages; otherwise
+	 * fall back to a temporary buffer we can fault into.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+	preempt_disable();
+	payload = __get_cpu_var(logger_scratch);
+	pagefault_disable();
+	ret = gather_from_user(payload, iov, nr_segs, header.len, true);
+	pagefault_enable();
+	if (unlikely(ret)) {
+		preempt_enable();
 
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		buf = kmalloc(header.len, GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		ret = gather_from_user(buf, iov, nr_segs, header.len, false);
+		if (ret) {
+			kfree(buf);
+			return ret;
 		}
 
-		iov++;
-		ret += nr;
+		payload = buf;
+		preempt_disable();
 	}
 
-	sec_logger_add_log_ram_console(log, orig);
+	len = sizeof(struct logger_entry) + header.len;
+	pos = reserve_log(log, len);
+	do_write_log(log, pos, &header, sizeof(struct logger_entry));
+	do_write_log(log, pos + sizeof(struct logger_entry), payload,
+		     header.len);
+	commit_log(log, pos, len);
 
-	mutex_unlock(&log->mutex);
+	/*
+	 * Feed the platform log from our own copy of the payload: once
+	 * committed, the entry in the ring may be overwritten at any time.
+	 */
+	sec_logger_add_log_ram_console(log->misc.name, &header, payload);
+	sec_logger_print_message(payload, header.len);
+
+	preempt_enable();
+	kfree(buf);
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
-	sec_logger_print_buffer();
-
-	return ret;
+	return header.len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -516,13 +570,7 @@ static int logger_open(struct inode *inode, struct file *file)
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
-
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		reader->r_off = ACCESS_ONCE(log->hdr->head);
 
 		file->private_data = reader;
 	} else
@@ -540,7 +588,6 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
 		kfree(reader);
 	}
 
@@ -560,6 +607,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 {
 	struct logger_reader *reader;
 	struct logger_log *log;
+	struct logger_entry entry;
 	unsigned int ret = POLLOUT | POLLWRNORM;
 
 	if (!(file->f_mode & FMODE_READ))
@@ -571,11 +619,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	if (get_next_entry_by_uid(log, reader, &entry))
 		ret |= POLLIN | POLLRDNORM;
 	mutex_unlock(&log->mutex);
 
@@ -599,6 +643,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_entry entry;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
@@ -614,10 +659,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		fix_up_reader(log, reader);
+		ret = get_commit(log) - reader->r_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -626,13 +669,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		reader = file->private_data;
 
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
-			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
+		if (get_next_entry_by_uid(log, reader, &entry))
+			ret = get_user_hdr_len(reader->r_ver) + entry.len;
 		else
 			ret = 0;
 		break;
@@ -641,9 +679,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers are pulled forward as they next look at the log */
+		fix_up_head(log, get_commit(log));
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -669,11 +706,55 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the header page and the ring read-only; see struct logger_mmap_header
+ * for how to read entries from the mapping.  As the ring holds every user's
+ * entries, only readers allowed to read all of them may map it.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_reader *reader;
+	struct logger_log *log;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	reader = file->private_data;
+	log = reader->log;
+
+	if (!reader->r_all)
+		return -EPERM;
+
+	if (vma->vm_pgoff ||
+	    vma->vm_end - vma->vm_start != PAGE_SIZE + log->size)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND | VM_RESERVED;
+
+	ret = remap_pfn_range(vma, vma->vm_start,
+			      virt_to_phys(log->hdr) >> PAGE_SHIFT,
+			      PAGE_SIZE, vma->vm_page_prot);
+	if (ret)
+		return ret;
+
+	return remap_pfn_range(vma, vma->vm_start + PAGE_SIZE,
+			       virt_to_phys(log->buffer) >> PAGE_SHIFT,
+			       log->size, vma->vm_page_prot);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -683,12 +764,12 @@ static const struct file_operations logger_fops = {
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
  * must be a power of two, and greater than
- * (LOGGER_ENTRY_MAX_PAYLOAD + sizeof(struct logger_entry)).
+ * (LOGGER_ENTRY_MAX_PAYLOAD + sizeof(struct logger_entry)).  The ring itself
+ * is allocated by init_log(): it is mapped to userspace by pfn, so it must
+ * come from the page allocator rather than a (module's vmalloc'd) array.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -696,10 +777,8 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
 	.w_off = 0, \
-	.head = 0, \
 	.size = SIZE, \
 };
 
@@ -725,17 +804,44 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	/* every cpu may hold one uncommitted entry while another is written */
+	if (log->size < (num_possible_cpus() + 1) * LOGGER_ENTRY_MAX_LEN) {
+		printk(KERN_ERR "logger: log '%s' is too small!\n",
+		       log->misc.name);
+		return -EINVAL;
+	}
+
+	log->hdr = (struct logger_mmap_header *) get_zeroed_page(GFP_KERNEL);
+	if (!log->hdr)
+		return -ENOMEM;
+	log->hdr->size = log->size;
+
+	log->buffer = (unsigned char *) __get_free_pages(GFP_KERNEL | __GFP_ZERO,
+							 get_order(log->size));
+	if (!log->buffer) {
+		ret = -ENOMEM;
+		goto out_hdr;
+	}
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
-		return ret;
+		goto out_buffer;
 	}
 
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
 
 	return 0;
+
+out_buffer:
+	free_pages((unsigned long) log->buffer, get_order(log->size));
+	log->buffer = NULL;
+out_hdr:
+	free_page((unsigned long) log->hdr);
+	log->hdr = NULL;
+	return ret;
 }
 
 static int __init logger_init(void)
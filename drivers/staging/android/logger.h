@@ -51,6 +51,25 @@ struct logger_entry {
 	char		msg[0];		/* the entry's payload */
 };
 
+/*
+ * A log may be mapped read-only by readers allowed to read all of its
+ * entries.  The first page of the mapping holds a struct logger_mmap_header,
+ * and the 'size' bytes of the ring follow on the next page.
+ *
+ * Positions only ever increase, wrapping at 2^32.  The entry at position
+ * 'pos' (a struct logger_entry followed by its payload) starts at byte
+ * (pos & (size - 1)) of the ring and may wrap around its end.  Entries in
+ * [head, commit) are complete.  To read one, load 'commit', issue a read
+ * barrier, copy the entry, issue another read barrier and then reload
+ * 'head': if 'head' has moved past the entry's position, writers have
+ * overwritten it and the copy must be discarded.
+ */
+struct logger_mmap_header {
+	__u32		size;		/* size of the ring, a power of two */
+	__u32		head;		/* position of the oldest entry */
+	__u32		commit;		/* position past the newest entry */
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
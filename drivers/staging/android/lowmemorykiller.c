@@ -16,6 +16,22 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept in buckets by oom_adj, updated on fork, exec, exit and
+ * oom_adj changes, so that picking a victim only looks at the highest
+ * bucket at or above the minimum oom_adj.  The largest process of each
+ * bucket is cached for a short while since the shrinker is called many
+ * times per second under memory pressure.
+ *
+ * /dev/lowmem_pressure reports a memory pressure level, one of "none",
+ * "low", "medium" or "critical", so that user-space can trim its caches
+ * before processes have to be killed.  The level follows the same minfree
+ * thresholds, the last one being "low" and the first one "critical", and
+ * is raised by one step while reclaim is scanning far more pages than it
+ * frees.  The level is re-evaluated whenever it is read or polled, and
+ * every second while it is raised, so that it drops back once reclaim
+ * stops.  poll() on the device reports POLLPRI when the level changed
+ * since the caller last read it; seek back to 0 to read the new level.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -31,10 +47,17 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
+#include <linux/poll.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/workqueue.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,12 +78,201 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+#define LOWMEM_BUCKETS		(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define LOWMEM_RSS_CACHE_TIME	(HZ / 10)
+
+struct lowmem_bucket {
+	struct list_head tasks;		/* thread group leaders */
+	struct task_struct *selected;	/* largest task, if valid */
+	int selected_tasksize;
+	int valid;
+	unsigned long expires;
+};
+
+/*
+ * Nests inside tasklist_lock and outside task_lock().  Taken with irqs
+ * disabled since tasks are freed from RCU callbacks.
+ */
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+static struct lowmem_bucket lowmem_buckets[LOWMEM_BUCKETS];
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+static struct lowmem_bucket *lowmem_bucket_of(int oom_adj)
+{
+	oom_adj = clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX);
+	return &lowmem_buckets[oom_adj - OOM_DISABLE];
+}
+
+/* Must be called with lowmem_bucket_lock held */
+static void lowmem_untrack(struct task_struct *task)
+{
+	struct lowmem_bucket *bucket = &lowmem_buckets[task->lowmem_bucket];
+
+	if (list_empty(&task->lowmem_entry))
+		return;
+	list_del_init(&task->lowmem_entry);
+	if (bucket->selected == task)
+		bucket->valid = 0;
+}
+
+/* Must be called with lowmem_bucket_lock held */
+static void lowmem_track(struct task_struct *task)
+{
+	struct lowmem_bucket *bucket = lowmem_bucket_of(task->signal->oom_adj);
+
+	lowmem_untrack(task);
+	list_add_tail(&task->lowmem_entry, &bucket->tasks);
+	task->lowmem_bucket = bucket - lowmem_buckets;
+	bucket->valid = 0;
+}
+
+enum lowmem_pressure_level {
+	LOWMEM_PRESSURE_NONE,
+	LOWMEM_PRESSURE_LOW,
+	LOWMEM_PRESSURE_MEDIUM,
+	LOWMEM_PRESSURE_CRITICAL,
+};
+
+static const char * const lowmem_pressure_names[] = {
+	"none", "low", "medium", "critical",
+};
+
+/* reclaim efficiency, in percent, below which the level is raised */
+static int lowmem_pressure_efficiency = 25;
+static int lowmem_pressure_level;
+static unsigned long lowmem_pressure_inefficient_until;
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+static void lowmem_pressure_work_fn(struct work_struct *work);
+static DECLARE_DEFERRED_WORK(lowmem_pressure_work, lowmem_pressure_work_fn);
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+static DEFINE_MUTEX(lowmem_vm_events_lock);
+static unsigned long lowmem_vm_events[NR_VM_EVENT_ITEMS];
+static unsigned long lowmem_last_scanned;
+static unsigned long lowmem_last_reclaimed;
+static unsigned long lowmem_vm_events_next;
+
+/*
+ * Samples how many of the pages scanned by reclaim since the last call
+ * were actually freed, at most every HZ / 10.  Inefficient reclaim keeps
+ * the level raised for a second.
+ */
+static void lowmem_sample_reclaim(void)
+{
+	unsigned long scanned = 0, reclaimed = 0;
+	int i;
+
+	if (time_before(jiffies, lowmem_vm_events_next) ||
+	    !mutex_trylock(&lowmem_vm_events_lock))
+		return;
+	lowmem_vm_events_next = jiffies + HZ / 10;
+	all_vm_events(lowmem_vm_events);
+	for (i = 0; i < MAX_NR_ZONES; i++) {
+		scanned += lowmem_vm_events[PGSCAN_KSWAPD_NORMAL -
+					    ZONE_NORMAL + i];
+		scanned += lowmem_vm_events[PGSCAN_DIRECT_NORMAL -
+					    ZONE_NORMAL + i];
+		reclaimed += lowmem_vm_events[PGSTEAL_NORMAL -
+					      ZONE_NORMAL + i];
+	}
+	if (lowmem_last_scanned &&
+	    scanned - lowmem_last_scanned > SWAP_CLUSTER_MAX &&
+	    (reclaimed - lowmem_last_reclaimed) * 100 <
+	    (scanned - lowmem_last_scanned) * lowmem_pressure_efficiency)
+		lowmem_pressure_inefficient_until = jiffies + HZ;
+	lowmem_last_scanned = scanned;
+	lowmem_last_reclaimed = reclaimed;
+	mutex_unlock(&lowmem_vm_events_lock);
+}
+#else
+static void lowmem_sample_reclaim(void)
+{
+}
+#endif
+
+/*
+ * @crossed is the index of the most severe minfree threshold that free
+ * memory is below, or @array_size if none is.
+ */
+static void lowmem_pressure_update(int crossed, int array_size)
+{
+	int level, old;
+
+	if (crossed >= array_size)
+		level = LOWMEM_PRESSURE_NONE;
+	else if (crossed == 0)
+		level = LOWMEM_PRESSURE_CRITICAL;
+	else if (crossed < array_size - 1)
+		level = LOWMEM_PRESSURE_MEDIUM;
+	else
+		level = LOWMEM_PRESSURE_LOW;
+
+	if (level != LOWMEM_PRESSURE_NONE &&
+	    level != LOWMEM_PRESSURE_CRITICAL &&
+	    time_before(jiffies, lowmem_pressure_inefficient_until))
+		level++;
+
+	spin_lock(&lowmem_pressure_lock);
+	old = lowmem_pressure_level;
+	lowmem_pressure_level = level;
+	spin_unlock(&lowmem_pressure_lock);
+
+	/* nothing else lowers the level once reclaim stops */
+	if (level != LOWMEM_PRESSURE_NONE &&
+	    !delayed_work_pending(&lowmem_pressure_work))
+		schedule_delayed_work(&lowmem_pressure_work, HZ);
+
+	if (level != old) {
+		lowmem_print(3, "lowmem pressure %s -> %s\n",
+			     lowmem_pressure_names[old],
+			     lowmem_pressure_names[level]);
+		wake_up_interruptible(&lowmem_pressure_wait);
+	}
+}
+
+/* re-evaluates the level from the current free and file pages */
+static void lowmem_pressure_recompute(void)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	int other_free = global_page_state(NR_FREE_PAGES);
+	int other_file = global_page_state(NR_FILE_PAGES) -
+						global_page_state(NR_SHMEM);
+	int i;
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	for (i = 0; i < array_size; i++)
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i])
+			break;
+	lowmem_pressure_update(i, array_size);
+}
+
+static void lowmem_pressure_work_fn(struct work_struct *work)
+{
+	lowmem_pressure_recompute();
+}
+
+static int lowmem_pressure_get(void)
+{
+	int level;
+
+	lowmem_pressure_recompute();
+	spin_lock(&lowmem_pressure_lock);
+	level = lowmem_pressure_level;
+	spin_unlock(&lowmem_pressure_lock);
+	return level;
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -72,19 +284,90 @@ static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
+	unsigned long flags;
 
 	if (task == lowmem_deathpending)
 		lowmem_deathpending = NULL;
 
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	lowmem_untrack(task);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static int
+task_leader_notify_func(struct notifier_block *self, unsigned long val,
+			void *data)
+{
+	struct task_struct *task = data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	lowmem_track(task);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block task_leader_nb = {
+	.notifier_call	= task_leader_notify_func,
+};
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val,
+		    void *data)
+{
+	struct task_struct *task = data;
+	struct task_struct *leader;
+	unsigned long flags;
+
+	/* tasklist_lock keeps group_leader stable against de_thread() */
+	read_lock(&tasklist_lock);
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	/* only leaders are tracked; the leader may be exiting */
+	leader = task->group_leader;
+	if (!list_empty(&leader->lowmem_entry))
+		lowmem_track(leader);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+	read_unlock(&tasklist_lock);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+/* Must be called with lowmem_bucket_lock held */
+static void lowmem_select_in_bucket(struct lowmem_bucket *bucket)
 {
 	struct task_struct *p;
+	int tasksize;
+
+	bucket->selected = NULL;
+	bucket->selected_tasksize = 0;
+	list_for_each_entry(p, &bucket->tasks, lowmem_entry) {
+		task_lock(p);
+		if (!p->mm) {
+			task_unlock(p);
+			continue;
+		}
+		tasksize = get_mm_rss(p->mm);
+		task_unlock(p);
+		if (tasksize <= bucket->selected_tasksize)
+			continue;
+		bucket->selected = p;
+		bucket->selected_tasksize = tasksize;
+	}
+	bucket->valid = 1;
+	bucket->expires = jiffies + LOWMEM_RSS_CACHE_TIME;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
 	struct task_struct *selected = NULL;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
@@ -116,6 +399,9 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			break;
 		}
 	}
+	if (sc->nr_to_scan > 0)
+		lowmem_sample_reclaim();
+	lowmem_pressure_update(i, array_size);
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -129,44 +415,33 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
-
+	/*
+	 * tasklist_lock keeps a task that still has an mm from being
+	 * released until it has been sent the signal.
+	 */
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
+	spin_lock_irq(&lowmem_bucket_lock);
+	for (selected_oom_adj = OOM_ADJUST_MAX;
+	     selected_oom_adj >= min_adj; selected_oom_adj--) {
+		struct lowmem_bucket *bucket =
+			lowmem_bucket_of(selected_oom_adj);
 
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
+		if (list_empty(&bucket->tasks))
 			continue;
+		if (!bucket->valid || time_after(jiffies, bucket->expires) ||
+		    (bucket->selected && !bucket->selected->mm))
+			lowmem_select_in_bucket(bucket);
+		if (bucket->selected) {
+			selected = bucket->selected;
+			selected_tasksize = bucket->selected_tasksize;
+			break;
 		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	spin_unlock_irq(&lowmem_bucket_lock);
 	if (selected) {
+		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+			     selected->pid, selected->comm, selected_oom_adj,
+			     selected_tasksize);
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
@@ -186,16 +461,84 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+/* file->private_data holds the last level read through the file */
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	file->private_data = (void *)(long)LOWMEM_PRESSURE_NONE;
+	return 0;
+}
+
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	int level = lowmem_pressure_get();
+	char tmp[16];
+	size_t len;
+
+	len = scnprintf(tmp, sizeof(tmp), "%s\n",
+			lowmem_pressure_names[level]);
+	if (*ppos == 0)
+		file->private_data = (void *)(long)level;
+	return simple_read_from_buffer(buf, count, ppos, tmp, len);
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &lowmem_pressure_wait, wait);
+	if (lowmem_pressure_get() != (long)file->private_data)
+		return POLLIN | POLLRDNORM | POLLPRI;
+	return 0;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.read = lowmem_pressure_read,
+	.poll = lowmem_pressure_poll,
+	.llseek = default_llseek,
+};
+
+static struct miscdevice lowmem_pressure_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmem_pressure",
+	.fops = &lowmem_pressure_fops,
+};
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i].tasks);
+
 	task_free_register(&task_nb);
+	task_leader_register(&task_leader_nb);
+	register_oom_adj_notifier(&oom_adj_nb);
+
+	/* pick up the processes that were started before us */
+	read_lock(&tasklist_lock);
+	spin_lock_irq(&lowmem_bucket_lock);
+	for_each_process(p)
+		if (list_empty(&p->lowmem_entry))
+			lowmem_track(p);
+	spin_unlock_irq(&lowmem_bucket_lock);
+	read_unlock(&tasklist_lock);
+
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_pressure_dev))
+		printk(KERN_ERR "lowmemorykiller: failed to register "
+		       "pressure device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	misc_deregister(&lowmem_pressure_dev);
 	unregister_shrinker(&lowmem_shrinker);
+	cancel_delayed_work_sync(&lowmem_pressure_work);
+	unregister_oom_adj_notifier(&oom_adj_nb);
+	task_leader_unregister(&task_leader_nb);
 	task_free_unregister(&task_nb);
 }
 
@@ -205,6 +548,8 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_efficiency, lowmem_pressure_efficiency, int,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
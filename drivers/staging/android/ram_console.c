@@ -26,15 +26,36 @@
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 #include <linux/rslib.h>
 #endif
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+#include <linux/lz4.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#endif
 
+/*
+ * Without compression, data[] is a ring of console text and 'start' and
+ * 'size' are its write offset and fill level.
+ *
+ * With compression, data[] starts with a chunk of plain text, 'pending'
+ * bytes long, followed by a ring of compressed chunks which 'start',
+ * 'size' and 'first' (the offset of the oldest chunk) describe.
+ */
 struct ram_console_buffer {
 	uint32_t    sig;
 	uint32_t    start;
 	uint32_t    size;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	uint32_t    first;
+	uint32_t    pending;
+#endif
 	uint8_t     data[0];
 };
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+#define RAM_CONSOLE_SIG (0x5a474244) /* DBGZ */
+#else
 #define RAM_CONSOLE_SIG (0x43474244) /* DBGC */
+#endif
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_EARLY_INIT
 static char __initdata
@@ -55,6 +76,32 @@ static int ram_console_bad_blocks;
 #define ECC_SYMSIZE CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION_SYMBOL_SIZE
 #define ECC_POLY CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION_POLYNOMIAL
 #endif
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+#define CHUNK_SIZE CONFIG_ANDROID_RAM_CONSOLE_COMPRESS_CHUNK_SIZE
+
+/* a compressed chunk in the ring, stored as is if it did not compress */
+struct ram_console_chunk {
+	uint16_t    len;	/* uncompressed length */
+	uint16_t    zlen;	/* stored length, equal to len if not compressed */
+};
+
+#define CHUNK_MAX_ZLEN lz4_compressbound(CHUNK_SIZE)
+
+static size_t ram_console_ring_size;
+/* protects the pending chunk, the ring and the compression buffers */
+static DEFINE_SPINLOCK(ram_console_lock);
+static uint8_t ram_console_zbuf[CHUNK_MAX_ZLEN];
+static uint8_t ram_console_zwork[LZ4_MEM_COMPRESS] __aligned(sizeof(u32));
+
+/* the compressed part of the old log, decompressed a chunk at a time */
+static uint8_t *ram_console_old_zlog;
+static uint32_t *ram_console_old_chunks;
+static unsigned int ram_console_old_nr_chunks;
+static size_t ram_console_old_zsize;
+static char *ram_console_old_chunk;
+static int ram_console_old_chunk_idx = -1;
+static DEFINE_MUTEX(ram_console_old_lock);
+#endif
 
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 static void ram_console_encode_rs8(uint8_t *data, size_t len, uint8_t *ecc)
@@ -79,7 +126,8 @@ static int ram_console_decode_rs8(void *data, size_t len, uint8_t *ecc)
 }
 #endif
 
-static void ram_console_update(const char *s, unsigned int count)
+/* ram_console_update - write 'count' bytes at offset 'off' of the data */
+static void ram_console_update(size_t off, const char *s, unsigned int count)
 {
 	struct ram_console_buffer *buffer = ram_console_buffer;
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
@@ -88,18 +136,17 @@ static void ram_console_update(const char *s, unsigned int count)
 	uint8_t *par;
 	int size = ECC_BLOCK_SIZE;
 #endif
-	memcpy(buffer->data + buffer->start, s, count);
+	memcpy(buffer->data + off, s, count);
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
-	block = buffer->data + (buffer->start & ~(ECC_BLOCK_SIZE - 1));
-	par = ram_console_par_buffer +
-	      (buffer->start / ECC_BLOCK_SIZE) * ECC_SIZE;
+	block = buffer->data + (off & ~(ECC_BLOCK_SIZE - 1));
+	par = ram_console_par_buffer + (off / ECC_BLOCK_SIZE) * ECC_SIZE;
 	do {
 		if (block + ECC_BLOCK_SIZE > buffer_end)
 			size = buffer_end - block;
 		ram_console_encode_rs8(block, size, par);
 		block += ECC_BLOCK_SIZE;
 		par += ECC_SIZE;
-	} while (block < buffer->data + buffer->start + count);
+	} while (block < buffer->data + off + count);
 #endif
 }
 
@@ -114,6 +161,106 @@ static void ram_console_update_header(void)
 #endif
 }
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+static inline size_t ram_console_ring_add(size_t off, size_t n)
+{
+	off += n;
+	if (off >= ram_console_ring_size)
+		off -= ram_console_ring_size;
+	return off;
+}
+
+static void ram_console_ring_read(size_t off, void *dest, size_t count)
+{
+	const uint8_t *ring = ram_console_buffer->data + CHUNK_SIZE;
+	size_t len = min(count, ram_console_ring_size - off);
+
+	memcpy(dest, ring + off, len);
+	memcpy(dest + len, ring, count - len);
+}
+
+static size_t ram_console_ring_write(size_t off, const void *s, size_t count)
+{
+	size_t len = min(count, ram_console_ring_size - off);
+
+	ram_console_update(CHUNK_SIZE + off, s, len);
+	if (count != len)
+		ram_console_update(CHUNK_SIZE, s + len, count - len);
+	return ram_console_ring_add(off, count);
+}
+
+/*
+ * ram_console_flush_chunk - compress the pending chunk into the ring,
+ * dropping the oldest chunks to make room.
+ *
+ * Called from the console write path with ram_console_lock held.
+ */
+static void ram_console_flush_chunk(void)
+{
+	struct ram_console_buffer *buffer = ram_console_buffer;
+	struct ram_console_chunk chunk, old;
+	const uint8_t *data = ram_console_zbuf;
+	size_t zlen = sizeof(ram_console_zbuf);
+	size_t rec;
+
+	chunk.len = buffer->pending;
+	if (lz4_compress(buffer->data, chunk.len, ram_console_zbuf, &zlen,
+			 ram_console_zwork) || zlen >= chunk.len) {
+		data = buffer->data;
+		zlen = chunk.len;
+	}
+	chunk.zlen = zlen;
+	rec = sizeof(chunk) + zlen;
+
+	/*
+	 * Retire the chunks we overwrite before writing anything, so that a
+	 * crash halfway never leaves the header pointing at a clobbered one.
+	 */
+	while (buffer->size + rec > ram_console_ring_size) {
+		ram_console_ring_read(buffer->first, &old, sizeof(old));
+		buffer->first = ram_console_ring_add(buffer->first,
+						     sizeof(old) + old.zlen);
+		buffer->size -= sizeof(old) + old.zlen;
+	}
+	ram_console_update_header();
+
+	buffer->start = ram_console_ring_write(buffer->start, &chunk,
+					       sizeof(chunk));
+	buffer->start = ram_console_ring_write(buffer->start, data, zlen);
+	buffer->size += rec;
+	buffer->pending = 0;
+}
+
+static void
+ram_console_write(struct console *console, const char *s, unsigned int count)
+{
+	struct ram_console_buffer *buffer = ram_console_buffer;
+	unsigned long flags;
+	unsigned int len;
+	int locked = 1;
+
+	/* do not deadlock on an oops taken while holding the lock */
+	if (oops_in_progress)
+		locked = spin_trylock_irqsave(&ram_console_lock, flags);
+	else
+		spin_lock_irqsave(&ram_console_lock, flags);
+
+	while (count) {
+		len = min_t(unsigned int, count, CHUNK_SIZE - buffer->pending);
+		ram_console_update(buffer->pending, s, len);
+		buffer->pending += len;
+		s += len;
+		count -= len;
+
+		if (buffer->pending == CHUNK_SIZE)
+			ram_console_flush_chunk();
+	}
+	ram_console_update_header();
+
+	if (locked)
+		spin_unlock_irqrestore(&ram_console_lock, flags);
+}
+#else
 static void
 ram_console_write(struct console *console, const char *s, unsigned int count)
 {
@@ -126,19 +273,20 @@ ram_console_write(struct console *console, const char *s, unsigned int count)
 	}
 	rem = ram_console_buffer_size - buffer->start;
 	if (rem < count) {
-		ram_console_update(s, rem);
+		ram_console_update(buffer->start, s, rem);
 		s += rem;
 		count -= rem;
 		buffer->start = 0;
 		buffer->size = ram_console_buffer_size;
 	}
-	ram_console_update(s, count);
+	ram_console_update(buffer->start, s, count);
 
 	buffer->start += count;
 	if (buffer->size < ram_console_buffer_size)
 		buffer->size += count;
 	ram_console_update_header();
 }
+#endif
 
 static struct console ram_console = {
 	.name	= "ram",
@@ -155,11 +303,82 @@ void ram_console_enable_console(int enabled)
 		ram_console.flags &= ~CON_ENABLED;
 }
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+/*
+ * ram_console_save_old_chunks - keep a copy of the old log's compressed
+ * chunks and index the ones that decompress, skipping any that error
+ * correction could not repair.
+ */
+static void __init
+ram_console_save_old_chunks(struct ram_console_buffer *buffer)
+{
+	struct ram_console_chunk chunk;
+	size_t off, dlen;
+	unsigned int nr = 0;
+
+	if (!buffer->size)
+		return;
+
+	ram_console_old_zlog = kmalloc(buffer->size, GFP_KERNEL);
+	ram_console_old_chunks = kmalloc(buffer->size / sizeof(chunk) *
+					 sizeof(uint32_t), GFP_KERNEL);
+	ram_console_old_chunk = kmalloc(CHUNK_SIZE, GFP_KERNEL);
+	if (!ram_console_old_zlog || !ram_console_old_chunks ||
+	    !ram_console_old_chunk) {
+		printk(KERN_ERR
+		       "ram_console: failed to allocate buffer for old chunks\n");
+		goto err;
+	}
+
+	ram_console_ring_read(buffer->first, ram_console_old_zlog,
+			      buffer->size);
+
+	for (off = 0; off + sizeof(chunk) <= buffer->size;
+	     off += sizeof(chunk) + chunk.zlen) {
+		memcpy(&chunk, ram_console_old_zlog + off, sizeof(chunk));
+		if (chunk.zlen > buffer->size - off - sizeof(chunk))
+			break;
+		if (chunk.len != CHUNK_SIZE || chunk.zlen > chunk.len)
+			continue;
+
+		if (chunk.zlen != chunk.len) {
+			dlen = CHUNK_SIZE;
+			if (lz4_decompress_unknownoutputsize(
+					ram_console_old_zlog + off + sizeof(chunk),
+					chunk.zlen, ram_console_old_chunk,
+					&dlen) || dlen != CHUNK_SIZE)
+				continue;
+		}
+		ram_console_old_chunks[nr++] = off;
+	}
+
+	if (off != buffer->size)
+		printk(KERN_INFO "ram_console: old log chunks end at %zu of "
+		       "%u\n", off, buffer->size);
+
+	ram_console_old_nr_chunks = nr;
+	ram_console_old_zsize = nr * CHUNK_SIZE;
+	return;
+
+err:
+	kfree(ram_console_old_zlog);
+	kfree(ram_console_old_chunks);
+	kfree(ram_console_old_chunk);
+	ram_console_old_zlog = NULL;
+	ram_console_old_chunks = NULL;
+	ram_console_old_chunk = NULL;
+}
+#endif
+
 static void __init
 ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 	char *dest)
 {
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	size_t old_log_size = buffer->pending;
+#else
 	size_t old_log_size = buffer->size;
+#endif
 	size_t bootinfo_size = 0;
 	size_t total_size = old_log_size;
 	char *ptr;
@@ -170,10 +389,15 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 	uint8_t *par;
 	char strbuf[80];
 	int strbuf_len = 0;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	size_t data_size = ram_console_buffer_size;
+#else
+	size_t data_size = buffer->size;
+#endif
 
 	block = buffer->data;
 	par = ram_console_par_buffer;
-	while (block < buffer->data + buffer->size) {
+	while (block < buffer->data + data_size) {
 		int numerr;
 		int size = ECC_BLOCK_SIZE;
 		if (block + size > buffer->data + ram_console_buffer_size)
@@ -206,6 +430,9 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 		strbuf_len = sizeof(strbuf) - 1;
 	total_size += strbuf_len;
 #endif
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	ram_console_save_old_chunks(buffer);
+#endif
 
 	if (bootinfo)
 		bootinfo_size = strlen(bootinfo) + strlen(bootinfo_label);
@@ -222,10 +449,14 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 
 	ram_console_old_log = dest;
 	ram_console_old_log_size = total_size;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	memcpy(ram_console_old_log, buffer->data, buffer->pending);
+#else
 	memcpy(ram_console_old_log,
 	       &buffer->data[buffer->start], buffer->size - buffer->start);
 	memcpy(ram_console_old_log + buffer->size - buffer->start,
 	       &buffer->data[0], buffer->start);
+#endif
 	ptr = ram_console_old_log + old_log_size;
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ERROR_CORRECTION
 	memcpy(ptr, strbuf, strbuf_len);
@@ -239,6 +470,19 @@ ram_console_save_old(struct ram_console_buffer *buffer, const char *bootinfo,
 	}
 }
 
+static bool __init ram_console_buffer_valid(struct ram_console_buffer *buffer)
+{
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	return buffer->size <= ram_console_ring_size &&
+	       buffer->start < ram_console_ring_size &&
+	       buffer->first < ram_console_ring_size &&
+	       buffer->pending <= CHUNK_SIZE;
+#else
+	return buffer->size <= ram_console_buffer_size &&
+	       buffer->start <= buffer->size;
+#endif
+}
+
 static int __init ram_console_init(struct ram_console_buffer *buffer,
 				   size_t buffer_size, const char *bootinfo,
 				   char *old_buf)
@@ -298,9 +542,18 @@ static int __init ram_console_init(struct ram_console_buffer *buffer,
 	}
 #endif
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	if (ram_console_buffer_size <
+	    CHUNK_SIZE + 2 * (sizeof(struct ram_console_chunk) + CHUNK_SIZE)) {
+		pr_err("ram_console: buffer %p, datasize %zu too small to "
+		       "compress\n", buffer, ram_console_buffer_size);
+		return 0;
+	}
+	ram_console_ring_size = ram_console_buffer_size - CHUNK_SIZE;
+#endif
+
 	if (buffer->sig == RAM_CONSOLE_SIG) {
-		if (buffer->size > ram_console_buffer_size
-		    || buffer->start > buffer->size)
+		if (!ram_console_buffer_valid(buffer))
 			printk(KERN_INFO "ram_console: found existing invalid "
 			       "buffer, size %d, start %d\n",
 			       buffer->size, buffer->start);
@@ -318,6 +571,10 @@ static int __init ram_console_init(struct ram_console_buffer *buffer,
 	buffer->sig = RAM_CONSOLE_SIG;
 	buffer->start = 0;
 	buffer->size = 0;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	buffer->first = 0;
+	buffer->pending = 0;
+#endif
 
 	register_console(&ram_console);
 #ifdef CONFIG_ANDROID_RAM_CONSOLE_ENABLE_VERBOSE
@@ -382,12 +639,61 @@ static int __init ram_console_module_init(void)
 }
 #endif
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+/*
+ * ram_console_read_old_chunk - read from the old chunk holding 'pos',
+ * decompressing it unless it is the one read last.
+ */
+static ssize_t ram_console_read_old_chunk(char __user *buf, size_t len,
+					  size_t pos)
+{
+	unsigned int idx = pos / CHUNK_SIZE;
+	size_t off = pos % CHUNK_SIZE;
+	struct ram_console_chunk chunk;
+	const uint8_t *src;
+	size_t dlen = CHUNK_SIZE;
+	ssize_t count;
+
+	mutex_lock(&ram_console_old_lock);
+	if (idx != ram_console_old_chunk_idx) {
+		src = ram_console_old_zlog + ram_console_old_chunks[idx];
+		memcpy(&chunk, src, sizeof(chunk));
+		src += sizeof(chunk);
+
+		/* chunks were checked to decompress when saved */
+		if (chunk.zlen == chunk.len)
+			memcpy(ram_console_old_chunk, src, CHUNK_SIZE);
+		else
+			lz4_decompress_unknownoutputsize(src, chunk.zlen,
+					ram_console_old_chunk, &dlen);
+		ram_console_old_chunk_idx = idx;
+	}
+
+	count = min(len, (size_t)(CHUNK_SIZE - off));
+	if (copy_to_user(buf, ram_console_old_chunk + off, count))
+		count = -EFAULT;
+	mutex_unlock(&ram_console_old_lock);
+
+	return count;
+}
+#endif
+
 static ssize_t ram_console_read_old(struct file *file, char __user *buf,
 				    size_t len, loff_t *offset)
 {
 	loff_t pos = *offset;
 	ssize_t count;
 
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	if (pos < ram_console_old_zsize) {
+		count = ram_console_read_old_chunk(buf, len, pos);
+		if (count > 0)
+			*offset += count;
+		return count;
+	}
+	pos -= ram_console_old_zsize;
+#endif
+
 	if (pos >= ram_console_old_log_size)
 		return 0;
 
@@ -431,6 +737,9 @@ static int __init ram_console_late_init(void)
 
 	entry->proc_fops = &ram_console_file_ops;
 	entry->size = ram_console_old_log_size;
+#ifdef CONFIG_ANDROID_RAM_CONSOLE_COMPRESS
+	entry->size += ram_console_old_zsize;
+#endif
 	return 0;
 }
 
@@ -26,30 +26,40 @@
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
+#include <linux/file.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
+#include <linux/lz4.h>
 #include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
 /* Globals */
 static int zram_major;
 struct zram *devices;
+static struct kmem_cache *zram_entry_cache;
 
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(struct zram *zram, u32 *v)
 {
+	spin_lock(&zram->stat64_lock);
 	*v = *v + 1;
+	spin_unlock(&zram->stat64_lock);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(struct zram *zram, u32 *v)
 {
+	spin_lock(&zram->stat64_lock);
 	*v = *v - 1;
+	spin_unlock(&zram->stat64_lock);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -89,18 +99,259 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static spinlock_t *zram_table_lock(struct zram *zram, u32 index)
 {
-	unsigned int pos;
+	return &zram->table_lock[index & (ZRAM_TABLE_LOCKS - 1)];
+}
+
+static int zram_lzo_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem)
+{
+	return lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+static int zram_lzo_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+
+	return lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+}
+
+static int zram_lz4_compress(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem)
+{
+	return lz4_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+static int zram_lz4_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+	int ret;
+
+	ret = lz4_decompress_unknownoutputsize(src, src_len, dst, &dst_len);
+	if (!ret && dst_len != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
+
+static const struct zram_compressor zram_lzo = {
+	.name = "lzo",
+	.workmem_size = LZO1X_MEM_COMPRESS,
+	.compress = zram_lzo_compress,
+	.decompress = zram_lzo_decompress,
+};
+
+/* Decompresses faster than lzo, at a somewhat worse ratio */
+static const struct zram_compressor zram_lz4 = {
+	.name = "lz4",
+	.workmem_size = LZ4_MEM_COMPRESS,
+	.compress = zram_lz4_compress,
+	.decompress = zram_lz4_decompress,
+};
+
+/* The first entry is the default */
+const struct zram_compressor *zram_compressors[] = {
+	&zram_lzo,
+	&zram_lz4,
+	NULL,
+};
+
+const struct zram_compressor *zram_find_compressor(const char *name)
+{
+	int i;
+
+	for (i = 0; zram_compressors[i]; i++) {
+		if (sysfs_streq(zram_compressors[i]->name, name))
+			return zram_compressors[i];
+	}
+
+	return NULL;
+}
+
+static void zram_free_stream(struct zram_stream *zstrm)
+{
+	kfree(zstrm->workmem);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zram_stream *zram_alloc_stream(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_NOIO);
+	if (!zstrm)
+		return NULL;
+	zstrm->workmem = kzalloc(zram->compressor->workmem_size, GFP_NOIO);
+	/* compressors may expand incompressible data past PAGE_SIZE */
+	zstrm->buffer = (void *)__get_free_pages(GFP_NOIO | __GFP_ZERO, 1);
+	if (!zstrm->workmem || !zstrm->buffer) {
+		zram_free_stream(zstrm);
+		return NULL;
+	}
+	return zstrm;
+}
+
+/*
+ * Returns an idle compression stream, allocating a new one while there
+ * are fewer than max_streams, and otherwise waiting for one to be put.
+ */
+static struct zram_stream *zram_get_stream(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	for (;;) {
+		spin_lock(&zram->stream_lock);
+		if (!list_empty(&zram->idle_streams)) {
+			zstrm = list_first_entry(&zram->idle_streams,
+						 struct zram_stream, list);
+			list_del(&zstrm->list);
+			spin_unlock(&zram->stream_lock);
+			return zstrm;
+		}
+		if (zram->num_streams < zram->max_streams) {
+			zram->num_streams++;
+			spin_unlock(&zram->stream_lock);
+			zstrm = zram_alloc_stream(zram);
+			if (zstrm)
+				return zstrm;
+			spin_lock(&zram->stream_lock);
+			zram->num_streams--;
+			/* make do with the streams we have */
+			if (!zram->num_streams) {
+				spin_unlock(&zram->stream_lock);
+				return NULL;
+			}
+		}
+		spin_unlock(&zram->stream_lock);
+		wait_event(zram->stream_wait,
+			   !list_empty(&zram->idle_streams));
+	}
+}
+
+static void zram_put_stream(struct zram *zram, struct zram_stream *zstrm)
+{
+	spin_lock(&zram->stream_lock);
+	list_add(&zstrm->list, &zram->idle_streams);
+	spin_unlock(&zram->stream_lock);
+	wake_up(&zram->stream_wait);
+}
+
+static void zram_destroy_streams(struct zram *zram)
+{
+	struct zram_stream *zstrm, *tmp;
+
+	list_for_each_entry_safe(zstrm, tmp, &zram->idle_streams, list) {
+		list_del(&zstrm->list);
+		zram_free_stream(zstrm);
+	}
+	zram->num_streams = 0;
+}
+
+/*
+ * Returns 1 and the repeated word in @element if the page consists of
+ * a single repeated word.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
+{
+	unsigned int pos, last;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
+	last = PAGE_SIZE / sizeof(*page) - 1;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	/* Most pages that differ at all differ at the end */
+	if (page[0] != page[last])
+		return 0;
+
+	for (pos = 0; pos < last; pos++) {
+		if (page[pos] != page[pos + 1])
 			return 0;
 	}
 
+	*element = page[0];
+	return 1;
+}
+
+static u32 zram_dedup_checksum(const unsigned char *mem, size_t len)
+{
+	return jhash(mem, len, 0);
+}
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_buckets[checksum & (zram->dedup_nr_buckets - 1)];
+}
+
+/*
+ * Looks for a stored object whose compressed contents equal @mem and
+ * takes a reference to it.
+ */
+static struct zram_entry *zram_dedup_get(struct zram *zram,
+			const unsigned char *mem, size_t len, u32 checksum)
+{
+	int match;
+	void *cmem;
+	struct hlist_node *pos;
+	struct zram_entry *entry;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, zram_dedup_bucket(zram, checksum),
+			node) {
+		if (entry->checksum != checksum || entry->size != len)
+			continue;
+
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+		match = !memcmp(cmem, mem, len);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+		if (match) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+/* Makes a newly stored object available to later identical pages */
+static struct zram_entry *zram_dedup_add(struct zram *zram,
+			unsigned long handle, size_t len, u32 checksum)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->size = len;
+	entry->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, zram_dedup_bucket(zram, checksum));
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/* Drops a reference; returns 1 if the object itself was freed */
+static int zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return 0;
+	}
+	hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	kmem_cache_free(zram_entry_cache, entry);
 	return 1;
 }
 
@@ -133,56 +384,339 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* No. of pages read and written back per round of zram_writeback() */
+#define ZRAM_WB_BATCH	32
+
+/*
+ * Reads back from the backing device are issued from here.  It has a
+ * rescuer thread so that swap-in under memory pressure cannot stall
+ * waiting for a worker to be created.
+ */
+static struct workqueue_struct *zram_bdev_wq;
+
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bitmap_lock);
+	blk = find_next_zero_bit(zram->bitmap, zram->nr_blocks, 1);
+	if (blk < zram->nr_blocks)
+		__set_bit(blk, zram->bitmap);
+	else
+		blk = 0;
+	spin_unlock(&zram->bitmap_lock);
+
+	return blk;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bitmap_lock);
+	__clear_bit(blk, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+}
+
+/* Tracks a group of bios to the backing device */
+struct zram_bio_wait {
+	atomic_t pending;
+	int error;
+	struct completion done;
+};
+
+static void zram_bio_wait_init(struct zram_bio_wait *wait)
+{
+	/* The submitter holds one count until zram_bio_wait() */
+	atomic_set(&wait->pending, 1);
+	wait->error = 0;
+	init_completion(&wait->done);
+}
+
+static int zram_bio_wait(struct zram_bio_wait *wait)
+{
+	if (!atomic_dec_and_test(&wait->pending))
+		wait_for_completion(&wait->done);
+	return wait->error;
+}
+
+static void zram_bio_end_io(struct bio *bio, int err)
+{
+	struct zram_bio_wait *wait = bio->bi_private;
+
+	if (err)
+		wait->error = err;
+	if (atomic_dec_and_test(&wait->pending))
+		complete(&wait->done);
+	bio_put(bio);
+}
+
+static int zram_bdev_submit(struct zram *zram, int rw, struct page *page,
+			unsigned long blk, struct zram_bio_wait *wait)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = (sector_t)blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	bio->bi_end_io = zram_bio_end_io;
+	bio->bi_private = wait;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	atomic_inc(&wait->pending);
+	submit_bio(rw, bio);
+	return 0;
+}
+
+struct zram_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int error;
+};
+
+static void zram_read_work_fn(struct work_struct *work)
+{
+	int err;
+	struct zram_bio_wait wait;
+	struct zram_read_work *rw = container_of(work,
+					struct zram_read_work, work);
+
+	zram_bio_wait_init(&wait);
+	rw->error = zram_bdev_submit(rw->zram, READ, rw->page, rw->blk, &wait);
+	err = zram_bio_wait(&wait);
+	if (!rw->error)
+		rw->error = err;
+}
+
+/*
+ * Reads back a written back page.  Bios submitted from zram's own
+ * make_request are only queued until it returns, so waiting for one
+ * there would never finish: the read is issued from a worker instead.
+ */
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_read_work rw = {
+		.zram = zram,
+		.page = page,
+		.blk = blk,
+	};
+
+	INIT_WORK_ONSTACK(&rw.work, zram_read_work_fn);
+	queue_work(zram_bdev_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	if (!rw.error)
+		flush_dcache_page(page);
+	return rw.error;
+}
+
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->nr_blocks = 0;
+}
+
+static int __init zram_bdev_init(void)
+{
+	zram_bdev_wq = alloc_workqueue("zram_bdev",
+				WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+	return zram_bdev_wq ? 0 : -ENOMEM;
+}
+
+static void zram_bdev_exit(void)
+{
+	destroy_workqueue(zram_bdev_wq);
+}
+
+/*
+ * Opens the block device at @path for writeback, replacing any previous
+ * one.  A file can be used through a loop device.  Called with init_lock
+ * held on an uninitialized device.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int err;
+	struct file *file;
+	struct inode *inode;
+	struct block_device *bdev;
+	unsigned long nr_blocks, *bitmap;
+
+	file = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	inode = file->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		err = -ENOTBLK;
+		goto close;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	err = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (err < 0)
+		goto close;
+
+	nr_blocks = i_size_read(inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (nr_blocks < 2 || !bitmap) {
+		vfree(bitmap);
+		err = nr_blocks < 2 ? -EINVAL : -ENOMEM;
+		goto put;
+	}
+	/* Block 0 is never used so that a valid handle is never 0 */
+	__set_bit(0, bitmap);
+
+	zram_reset_backing_dev(zram);
+	zram->backing_dev = file;
+	zram->bdev = bdev;
+	zram->nr_blocks = nr_blocks;
+	zram->bitmap = bitmap;
+
+	pr_info("setup backing device %s\n", path);
+	return 0;
+
+put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+close:
+	filp_close(file, NULL);
+	return err;
+}
+
+/* Flags every stored page as idle; accessing it clears the flag again */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+	spinlock_t *lock;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		lock = zram_table_lock(zram, index);
+		spin_lock(lock);
+		if (zram->table[index].handle &&
+				!zram_test_flag(zram, index, ZRAM_SAME) &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		spin_unlock(lock);
+	}
+}
+#else
+static inline int zram_read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	return -EIO;
+}
+
+static inline void zram_reset_backing_dev(struct zram *zram)
+{
+}
+
+static inline int zram_bdev_init(void)
+{
+	return 0;
+}
+
+static inline void zram_bdev_exit(void)
+{
+}
+#endif
+
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	/* Whatever happens to the slot, it is no longer idle */
+	zram->table[index].flags &= ~(BIT(ZRAM_IDLE) | BIT(ZRAM_UNDER_WB));
 
-	if (unlikely(!page)) {
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
 		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
+		 * No memory is allocated for same filled pages.
+		 * Simply clear the flag and the stored word.
 		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
-		}
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		if (handle)
+			zram_stat_dec(zram, &zram->stats.pages_same);
+		else
+			zram_stat_dec(zram, &zram->stats.pages_zero);
+		zram->table[index].handle = 0;
 		return;
 	}
 
+	if (unlikely(!handle))
+		return;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, handle);
+		zram_stat_dec(zram, &zram->stats.pages_wb);
+		zram->table[index].handle = 0;
+		return;
+	}
+#endif
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page((struct page *)handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+		zram_stat_dec(zram, &zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = zram->table[index].size;
 	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+		zram_stat_dec(zram, &zram->stats.good_compress);
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		if (!zram_dedup_put(zram, (struct zram_entry *)handle)) {
+			/* Other pages still use the object */
+			zram_stat_dec(zram, &zram->stats.pages_dup);
+			goto out_shared;
+		}
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
 
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+out_shared:
+	zram_stat_dec(zram, &zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct page *page)
+static void handle_same_page(struct page *page, unsigned long element)
 {
-	void *user_mem;
+	unsigned int pos;
+	unsigned long *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (likely(!element)) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		for (pos = 0; pos < PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -194,8 +728,7 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic((struct page *)zram->table[index].handle, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -204,70 +737,90 @@ static void handle_uncompressed_page(struct zram *zram,
 	flush_dcache_page(page);
 }
 
-static void zram_read(struct zram *zram, struct bio *bio)
+/*
+ * Unless @access is false, reading the page clears its ZRAM_IDLE flag;
+ * zram_writeback() reading pages out leaves them idle.
+ */
+static int zram_read_page(struct zram *zram, struct page *page, u32 index,
+			bool access)
 {
+	int ret;
+	unsigned long handle;
+	unsigned char *user_mem, *cmem;
+	spinlock_t *lock = zram_table_lock(zram, index);
 
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	/*
+	 * The entry lock keeps the object from being freed or replaced
+	 * while it is being decompressed.
+	 */
+	spin_lock(lock);
+	handle = zram->table[index].handle;
+	if (access)
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		spin_unlock(lock);
+		handle_same_page(page, handle);
+		return 0;
+	}
 
-	zram_stat64_inc(zram, &zram->stats.num_reads);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		spin_unlock(lock);
+		return zram_read_from_bdev(zram, page, handle);
+	}
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+	/* Requested page is not present in compressed area */
+	if (unlikely(!handle)) {
+		spin_unlock(lock);
+		pr_debug("Read before write: index=%u", index);
+		handle_same_page(page, 0);
+		return 0;
+	}
 
-		page = bvec->bv_page;
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		spin_unlock(lock);
+		return 0;
+	}
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		handle = ((struct zram_entry *)handle)->handle;
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+	ret = zram->compressor->decompress(cmem, zram->table[index].size,
+					user_mem);
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	zs_unmap_object(zram->mem_pool, handle);
+	kunmap_atomic(user_mem, KM_USER0);
+	spin_unlock(lock);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return -EIO;
+	}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	flush_dcache_page(page);
+	return 0;
+}
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+static void zram_read(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	zram_stat64_inc(zram, &zram->stats.num_reads);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_read_page(zram, bvec->bv_page, index, true))
 			goto out;
-		}
-
-		flush_dcache_page(page);
 		index++;
 	}
 
@@ -279,121 +832,166 @@ out:
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+/*
+ * Compresses and stores @page at @index.  Only installing the result in
+ * the table is done under the entry lock; compression uses one of the
+ * device's streams so that writers on different CPUs run in parallel.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
-
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
-
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
-
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	int ret;
+	u32 checksum = 0;
+	size_t clen;
+	unsigned long handle, element;
+	struct page *page_store;
+	struct zram_stream *zstrm;
+	struct zram_entry *entry = NULL;
+	int dup = 0;
+	unsigned char *user_mem, *cmem, *src;
+	spinlock_t *lock = zram_table_lock(zram, index);
 
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		spin_lock(lock);
 		/*
 		 * System overwrites unused sectors. Free memory associated
 		 * with this sector now.
 		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
+		if (zram->table[index].handle ||
+				zram_test_flag(zram, index, ZRAM_SAME))
 			zram_free_page(zram, index);
+		if (element)
+			zram_stat_inc(zram, &zram->stats.pages_same);
+		else
+			zram_stat_inc(zram, &zram->stats.pages_zero);
+		zram->table[index].handle = element;
+		zram_set_flag(zram, index, ZRAM_SAME);
+		spin_unlock(lock);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		mutex_lock(&zram->lock);
-
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
-		}
+	zstrm = zram_get_stream(zram);
+	if (unlikely(!zstrm)) {
+		pr_err("Error allocating compression stream\n");
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -ENOMEM;
+	}
+	src = zstrm->buffer;
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = zram->compressor->compress(user_mem, src, &clen, zstrm->workmem);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		kunmap_atomic(user_mem, KM_USER0);
+	if (unlikely(ret)) {
+		zram_put_stream(zram, zstrm);
+		pr_err("Compression failed! err=%d\n", ret);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -EIO;
+	}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		zram_put_stream(zram, zstrm);
+		zstrm = NULL;
+		clen = PAGE_SIZE;
+		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!page_store)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+			return -ENOMEM;
 		}
+		src = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+		handle = (unsigned long)page_store;
+		goto install;
+	}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+	if (zram->use_dedup) {
+		checksum = zram_dedup_checksum(src, clen);
+		entry = zram_dedup_get(zram, src, clen, checksum);
+		if (entry) {
+			zram_put_stream(zram, zstrm);
+			handle = (unsigned long)entry;
+			dup = 1;
+			goto install;
 		}
+	}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	handle = zs_malloc(zram->mem_pool, clen, GFP_NOIO | __GFP_HIGHMEM);
+	if (unlikely(!handle)) {
+		zram_put_stream(zram, zstrm);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -ENOMEM;
+	}
 
-memstore:
-		zram->table[index].offset = offset;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	memcpy(cmem, src, clen);
+	zs_unmap_object(zram->mem_pool, handle);
+	zram_put_stream(zram, zstrm);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	/* Without an entry the object is simply not shared */
+	if (zram->use_dedup) {
+		entry = zram_dedup_add(zram, handle, clen, checksum);
+		if (entry)
+			handle = (unsigned long)entry;
+	}
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+install:
+	spin_lock(lock);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	if (zram->table[index].handle ||
+			zram_test_flag(zram, index, ZRAM_SAME))
+		zram_free_page(zram, index);
+
+	zram->table[index].handle = handle;
+	zram->table[index].size = clen;
+	if (!zstrm) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(zram, &zram->stats.pages_expand);
+	} else if (entry) {
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	}
 
-		memcpy(cmem, src, clen);
+	/* Update stats */
+	if (dup)
+		zram_stat_inc(zram, &zram->stats.pages_dup);
+	else
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	zram_stat_inc(zram, &zram->stats.pages_stored);
+	if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(zram, &zram->stats.good_compress);
+	spin_unlock(lock);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	return 0;
+}
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+static void zram_write(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-		mutex_unlock(&zram->lock);
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_write_page(zram, bvec->bv_page, index))
+			goto out;
 		index++;
 	}
 
@@ -405,6 +1003,119 @@ out:
 	bio_io_error(bio);
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Writes the stored pages flagged @flag (ZRAM_UNCOMPRESSED or ZRAM_IDLE)
+ * to the backing device, ZRAM_WB_BATCH at a time, and frees their memory.
+ * Slots rewritten or freed while their batch is in flight are left
+ * alone.  Called with init_lock held on an initialized device.
+ *
+ * Returns the no. of pages written back or a negative error.
+ */
+int zram_writeback(struct zram *zram, enum zram_pageflags flag)
+{
+	int i, n, err, ret = 0, written = 0;
+	size_t index = 0, nr_slots = zram->disksize >> PAGE_SHIFT;
+	struct page *pages[ZRAM_WB_BATCH] = { NULL };
+	unsigned long blks[ZRAM_WB_BATCH];
+	u32 indices[ZRAM_WB_BATCH];
+	struct zram_bio_wait wait;
+	struct blk_plug plug;
+	spinlock_t *lock;
+
+	if (!zram->backing_dev)
+		return -ENODEV;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	while (index < nr_slots && !ret) {
+		/* Copy out a batch of candidate pages */
+		for (n = 0; index < nr_slots && n < ZRAM_WB_BATCH; index++) {
+			lock = zram_table_lock(zram, index);
+			spin_lock(lock);
+			if (!zram->table[index].handle ||
+					!zram_test_flag(zram, index, flag) ||
+					zram_test_flag(zram, index, ZRAM_SAME) ||
+					zram_test_flag(zram, index, ZRAM_WB) ||
+					zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+				spin_unlock(lock);
+				continue;
+			}
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+			spin_unlock(lock);
+
+			blks[n] = zram_alloc_block(zram);
+			if (!blks[n] ||
+			    zram_read_page(zram, pages[n], index, false)) {
+				spin_lock(lock);
+				zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+				spin_unlock(lock);
+				if (!blks[n]) {
+					ret = -ENOSPC;
+					break;
+				}
+				zram_free_block(zram, blks[n]);
+				continue;
+			}
+			indices[n++] = index;
+		}
+		if (!n)
+			break;
+
+		zram_bio_wait_init(&wait);
+		blk_start_plug(&plug);
+		for (i = 0; i < n; i++) {
+			err = zram_bdev_submit(zram, WRITE, pages[i], blks[i],
+						&wait);
+			if (err)
+				wait.error = err;
+		}
+		blk_finish_plug(&plug);
+		err = zram_bio_wait(&wait);
+		zram_stat64_add(zram, &zram->stats.bd_writes, n);
+
+		for (i = 0; i < n; i++) {
+			lock = zram_table_lock(zram, indices[i]);
+			spin_lock(lock);
+			if (!err && zram_test_flag(zram, indices[i],
+						ZRAM_UNDER_WB)) {
+				zram_free_page(zram, indices[i]);
+				zram->table[indices[i]].handle = blks[i];
+				zram_set_flag(zram, indices[i], ZRAM_WB);
+				zram_stat_inc(zram, &zram->stats.pages_wb);
+				blks[i] = 0;
+				written++;
+			} else {
+				zram_clear_flag(zram, indices[i],
+						ZRAM_UNDER_WB);
+			}
+			spin_unlock(lock);
+
+			if (blks[i])
+				zram_free_block(zram, blks[i]);
+		}
+
+		if (err)
+			ret = err;
+		cond_resched();
+	}
+
+out:
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		if (pages[i])
+			__free_page(pages[i]);
+	}
+
+	return ret ? ret : written;
+}
+#endif
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -461,33 +1172,22 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_destroy_streams(zram);
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
-			continue;
-
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
-	}
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	vfree(zram->dedup_buckets);
+	zram->dedup_buckets = NULL;
+
+	zram_reset_backing_dev(zram);
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -501,6 +1201,7 @@ int zram_init_device(struct zram *zram)
 {
 	int ret;
 	size_t num_pages;
+	struct zram_stream *zstrm;
 
 	mutex_lock(&zram->init_lock);
 
@@ -511,19 +1212,16 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	/* streams beyond the first one are allocated on demand */
+	zram->max_streams = num_online_cpus();
+	zstrm = zram_alloc_stream(zram);
+	if (!zstrm) {
+		pr_err("Error allocating compression stream\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
+	zram->num_streams = 1;
+	list_add(&zstrm->list, &zram->idle_streams);
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -535,12 +1233,25 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	if (zram->use_dedup) {
+		/* About 8 stored pages per bucket when the disk is full */
+		zram->dedup_nr_buckets = roundup_pow_of_two(
+					max_t(size_t, num_pages >> 3, 64));
+		zram->dedup_buckets = vzalloc(zram->dedup_nr_buckets *
+					sizeof(*zram->dedup_buckets));
+		if (!zram->dedup_buckets) {
+			pr_err("Error allocating dedup hash table\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1277,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	spin_lock(zram_table_lock(zram, index));
 	zram_free_page(zram, index);
+	spin_unlock(zram_table_lock(zram, index));
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -578,10 +1291,20 @@ static const struct block_device_operations zram_devops = {
 static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
+	int i;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
+	zram->compressor = zram_compressors[0];
+	spin_lock_init(&zram->dedup_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+#endif
 	spin_lock_init(&zram->stat64_lock);
+	for (i = 0; i < ZRAM_TABLE_LOCKS; i++)
+		spin_lock_init(&zram->table_lock[i]);
+	spin_lock_init(&zram->stream_lock);
+	INIT_LIST_HEAD(&zram->idle_streams);
+	init_waitqueue_head(&zram->stream_wait);
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1387,21 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = zram_bdev_init();
+	if (ret)
+		goto free_cache;
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto bdev_exit;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1431,10 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+bdev_exit:
+	zram_bdev_exit();
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 out:
 	return ret;
 }
@@ -713,11 +1450,14 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_reset_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
+	zram_bdev_exit();
+	kmem_cache_destroy(zram_entry_cache);
 	pr_debug("Cleanup done!\n");
 }
 
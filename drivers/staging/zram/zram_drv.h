@@ -17,8 +17,9 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +27,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -51,9 +40,15 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HEADER_SIZE
+ * otherwise, zs_malloc() would always return failure.
+ */
+
+/*
+ * Table entries are protected by one of this many spinlocks, picked by
+ * the entry index.  Must be a power of 2.
  */
+#define ZRAM_TABLE_LOCKS	64
 
 /*-- End of configurable params */
 
@@ -68,8 +63,23 @@ enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/*
+	 * Page consists of a single repeated word, which is kept in the
+	 * handle field.  Zero filled pages are the common case.
+	 */
+	ZRAM_SAME,
+
+	/* Handle points to a zram_entry shared with identical pages */
+	ZRAM_DEDUP,
+
+	/* Page was written back; handle is its block on the backing device */
+	ZRAM_WB,
+
+	/* Page is being written back, cleared if the slot changes */
+	ZRAM_UNDER_WB,
+
+	/* Page has not been accessed since the last 'idle' marking */
+	ZRAM_IDLE,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -78,12 +88,50 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	/* zsmalloc handle, or the struct page of an uncompressed page */
+	unsigned long handle;
+	u16 size;	/* compressed size, valid if compressed */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/*
+ * A compressed object that can be shared by table entries with identical
+ * contents.  Entries are hashed on a checksum of the compressed data and
+ * protected by zram->dedup_lock.
+ */
+struct zram_entry {
+	struct hlist_node node;
+	unsigned long handle;
+	u32 checksum;
+	u16 size;
+	unsigned int refcount;
+};
+
+/*
+ * A compression backend.  compress() always compresses one PAGE_SIZE page
+ * into a buffer of at least 2 * PAGE_SIZE, and decompress() must produce
+ * exactly one page.  Both return 0 on success.
+ */
+struct zram_compressor {
+	const char *name;
+	size_t workmem_size;
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem);
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+};
+
+/*
+ * Compression working memory and output buffer.  A device keeps up to one
+ * stream per online CPU so that concurrent writes compress in parallel.
+ */
+struct zram_stream {
+	void *workmem;
+	void *buffer;
+	struct list_head list;
+};
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -93,19 +141,46 @@ struct zram_stats {
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of other same filled pages */
+	u32 pages_dup;		/* no. of pages sharing another's object */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	/* Can only be changed while the device is not initialized */
+	const struct zram_compressor *compressor;
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	spinlock_t table_lock[ZRAM_TABLE_LOCKS];
+	spinlock_t stat64_lock;	/* protect stats */
+
+	/* Compression streams */
+	spinlock_t stream_lock;
+	struct list_head idle_streams;
+	wait_queue_head_t stream_wait;
+	int num_streams;	/* allocated, idle or in use */
+	int max_streams;
+
+	/* Deduplication of identical compressed objects */
+	int use_dedup;
+	spinlock_t dedup_lock;
+	struct hlist_head *dedup_buckets;
+	unsigned long dedup_nr_buckets;	/* power of 2 */
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Set up before init; see zram_writeback() */
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned long nr_blocks;	/* backing device size in pages */
+	unsigned long *bitmap;		/* blocks in use, block 0 reserved */
+	spinlock_t bitmap_lock;
+#endif
+
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -126,7 +201,16 @@ extern unsigned int num_devices;
 extern struct attribute_group zram_disk_attr_group;
 #endif
 
+extern const struct zram_compressor *zram_compressors[];
+extern const struct zram_compressor *zram_find_compressor(const char *name);
+
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_pageflags flag);
+#endif
+
 #endif
@@ -0,0 +1,723 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped into size classes ZS_SIZE_CLASS_DELTA bytes apart
+ * and packed back to back into zspages, so unlike xvmalloc an object may
+ * cross into the next page of its zspage and the only per-object waste is
+ * the rounding to the class size plus a header word.
+ *
+ * Callers get an opaque handle rather than an address.  The handle is
+ * resolved with zs_map_object(), which also pins the object; unpinned
+ * objects may be moved by zs_compact() to release sparsely used zspages.
+ *
+ * Atomic kmap slots: zs_map_object() uses KM_USER1 until the matching
+ * zs_unmap_object(); the other entry points use KM_USER0 and KM_USER1
+ * internally, so they must not be called while either slot is in use.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Picks the zspage size (in pages) that leaves the least tail space
+ * unused for objects of @class_size.  For example, 3 objects of 1360
+ * bytes waste 16 bytes of a 4k page, while objects of 2064 bytes would
+ * waste almost half a page each without crossing a page boundary: 4
+ * pages hold 7 of them.
+ */
+static unsigned int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	unsigned int max_usedpc_pages = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_pages = i;
+		}
+	}
+
+	return max_usedpc_pages;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max_objs = class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objs)
+		return ZS_FULL;
+	if (inuse * 4 <= max_objs * ZS_ALMOST_FULL_QUARTERS)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Moves @zspage to the list matching its current usage.  Newly moved
+ * zspages go to the head so that allocation keeps filling the same ones.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg != zspage->fullness) {
+		list_move(&zspage->list, &class->fullness_list[newfg]);
+		zspage->fullness = newfg;
+	}
+
+	return newfg;
+}
+
+static unsigned long obj_location(struct zspage *zspage, unsigned int idx)
+{
+	unsigned long loc;
+
+	loc = (page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS) | idx;
+	return loc << HANDLE_TAG_BITS;
+}
+
+static struct zspage *location_to_zspage(unsigned long loc,
+					unsigned int *idx)
+{
+	loc >>= HANDLE_TAG_BITS;
+	*idx = loc & OBJ_INDEX_MASK;
+	return (struct zspage *)page_private(pfn_to_page(loc >> OBJ_INDEX_BITS));
+}
+
+static void pin_handle(unsigned long *handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, handle);
+}
+
+static int trypin_handle(unsigned long *handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, handle);
+}
+
+static void unpin_handle(unsigned long *handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, handle);
+}
+
+/* Maps the header word of object @idx; it never straddles two pages */
+static unsigned long *get_obj_head(struct zspage *zspage, unsigned int idx)
+{
+	unsigned long off = (unsigned long)idx * zspage->class->size;
+	unsigned char *addr;
+
+	addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], KM_USER0);
+	return (unsigned long *)(addr + (off & ~PAGE_MASK));
+}
+
+static void put_obj_head(unsigned long *head)
+{
+	kunmap_atomic(head, KM_USER0);
+}
+
+/*
+ * Copies object @idx, header included, to @buf (@to_buf set) or back
+ * from @buf into the zspage, one page at a time.
+ */
+static void copy_object(struct zspage *zspage, unsigned int idx,
+			char *buf, int to_buf)
+{
+	int len, size = zspage->class->size;
+	unsigned long off = (unsigned long)idx * size;
+	struct page **page = &zspage->pages[off >> PAGE_SHIFT];
+	unsigned char *addr;
+
+	off &= ~PAGE_MASK;
+	while (size) {
+		len = min_t(int, size, PAGE_SIZE - off);
+		addr = kmap_atomic(*page, KM_USER1);
+		if (to_buf)
+			memcpy(buf, addr + off, len);
+		else
+			memcpy(addr + off, buf, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		buf += len;
+		size -= len;
+		off = 0;
+		page++;
+	}
+}
+
+static void free_zspage(struct zspage *zspage)
+{
+	unsigned int i, nr_pages = zspage->class->pages_per_zspage;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (!zspage->pages[i])
+			break;
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+/*
+ * Allocates the pages of a new zspage and chains all its objects
+ * together on the zspage free list.
+ */
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	unsigned int i;
+	unsigned long *head;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	zspage->class = class;
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i]) {
+			free_zspage(zspage);
+			return NULL;
+		}
+	}
+	set_page_private(zspage->pages[0], (unsigned long)zspage);
+
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		head = get_obj_head(zspage, i);
+		if (i + 1 < class->objs_per_zspage)
+			*head = (i + 1) << OBJ_TAG_BITS;
+		else
+			*head = OBJ_END << OBJ_TAG_BITS;
+		put_obj_head(head);
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->freeobj = 0;
+	zspage->fullness = ZS_EMPTY;
+
+	return zspage;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	struct list_head *list;
+
+	list = &class->fullness_list[ZS_ALMOST_FULL];
+	if (!list_empty(list))
+		return list_first_entry(list, struct zspage, list);
+
+	list = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (!list_empty(list))
+		return list_first_entry(list, struct zspage, list);
+
+	return NULL;
+}
+
+/*
+ * Takes the first free object of @zspage for @handle and returns its
+ * index.  Called with class->lock held.
+ */
+static unsigned int obj_alloc(struct zspage *zspage, unsigned long *handle)
+{
+	unsigned int idx = zspage->freeobj;
+	unsigned long *head;
+
+	BUG_ON(idx == OBJ_END);
+
+	head = get_obj_head(zspage, idx);
+	zspage->freeobj = *head >> OBJ_TAG_BITS;
+	*head = (unsigned long)handle | OBJ_ALLOCATED_TAG;
+	put_obj_head(head);
+
+	zspage->inuse++;
+	zspage->class->inuse++;
+
+	return idx;
+}
+
+/* Called with class->lock held */
+static void obj_free(struct zspage *zspage, unsigned int idx)
+{
+	unsigned long *head;
+
+	head = get_obj_head(zspage, idx);
+	*head = zspage->freeobj << OBJ_TAG_BITS;
+	put_obj_head(head);
+
+	zspage->freeobj = idx;
+	zspage->inuse--;
+	zspage->class->inuse--;
+}
+
+/**
+ * zs_malloc - Allocate an object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of the object
+ * @flags: allocation flags, used for both metadata and backing pages
+ *
+ * Returns an opaque handle to the object, or 0 on failure.  Use
+ * zs_map_object() to access it.
+ *
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HEADER_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	unsigned long *handle;
+	struct size_class *class;
+	struct zspage *zspage, *new = NULL;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HEADER_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(pool->handle_cachep, flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size + ZS_HEADER_SIZE)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		new = alloc_zspage(class, flags);
+		if (unlikely(!new)) {
+			kmem_cache_free(pool->handle_cachep, handle);
+			return 0;
+		}
+		atomic_add(class->pages_per_zspage, &pool->pages_allocated);
+
+		spin_lock(&class->lock);
+		/* Someone else may have freed objects meanwhile */
+		zspage = find_get_zspage(class);
+		if (!zspage) {
+			zspage = new;
+			new = NULL;
+			list_add(&zspage->list,
+				&class->fullness_list[ZS_EMPTY]);
+			class->zspages++;
+		}
+	}
+
+	*handle = obj_location(zspage, obj_alloc(zspage, handle));
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	if (unlikely(new)) {
+		atomic_sub(class->pages_per_zspage, &pool->pages_allocated);
+		free_zspage(new);
+	}
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+/*
+ * Frees the object identified by @handle.  The caller must not have the
+ * object mapped.
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int idx;
+	unsigned long *h = (unsigned long *)handle;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Keeps compaction from moving the object under us */
+	pin_handle(h);
+	zspage = location_to_zspage(*h, &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(zspage, idx);
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY) {
+		list_del(&zspage->list);
+		class->zspages--;
+	}
+	spin_unlock(&class->lock);
+	unpin_handle(h);
+
+	if (fullness == ZS_EMPTY) {
+		atomic_sub(class->pages_per_zspage, &pool->pages_allocated);
+		free_zspage(zspage);
+	}
+
+	kmem_cache_free(pool->handle_cachep, h);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - Get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: how the object is going to be accessed
+ *
+ * The object stays pinned, and the CPU non-preemptible, until the
+ * matching zs_unmap_object().  Only one object can be mapped per CPU at
+ * a time.  Objects that cross a page boundary are copied to a per-cpu
+ * buffer, and copied back on unmap unless mapped ZS_MM_RO.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	unsigned int idx;
+	unsigned long off;
+	unsigned long *h = (unsigned long *)handle;
+	struct zspage *zspage;
+	struct zs_map_area *area;
+	int size;
+
+	BUG_ON(!handle);
+
+	pin_handle(h);
+	zspage = location_to_zspage(*h, &idx);
+	size = zspage->class->size;
+	off = (unsigned long)idx * size;
+
+	area = this_cpu_ptr(pool->map_area);
+	area->mm = mm;
+
+	if ((off & ~PAGE_MASK) + size <= PAGE_SIZE) {
+		area->kaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return area->kaddr + (off & ~PAGE_MASK) + ZS_HEADER_SIZE;
+	}
+
+	area->kaddr = NULL;
+	if (mm != ZS_MM_WO)
+		copy_object(zspage, idx, area->buf, 1);
+	else
+		/* copy_object() writes the header back as well */
+		*(unsigned long *)area->buf = (unsigned long)h |
+						OBJ_ALLOCATED_TAG;
+	return area->buf + ZS_HEADER_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned int idx;
+	unsigned long *h = (unsigned long *)handle;
+	struct zspage *zspage;
+	struct zs_map_area *area;
+
+	area = this_cpu_ptr(pool->map_area);
+	if (area->kaddr) {
+		kunmap_atomic(area->kaddr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		zspage = location_to_zspage(*h, &idx);
+		copy_object(zspage, idx, area->buf, 0);
+	}
+
+	unpin_handle(h);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* No. of zspages of @class that compaction could release */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long capacity = class->zspages * class->objs_per_zspage;
+
+	return (capacity - class->inuse) / class->objs_per_zspage;
+}
+
+/*
+ * Moves allocated objects from @src to @dst until either @src is empty
+ * or @dst is full.  Returns -EBUSY if an object of @src is pinned.
+ * Called with class->lock held.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *src, struct zspage *dst)
+{
+	unsigned int idx, didx;
+	unsigned long val, *head, *handle;
+	char *buf = this_cpu_ptr(pool->map_area)->buf;
+
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		if (!src->inuse || dst->inuse == class->objs_per_zspage)
+			break;
+
+		head = get_obj_head(src, idx);
+		val = *head;
+		put_obj_head(head);
+		if (!(val & OBJ_ALLOCATED_TAG))
+			continue;
+
+		handle = (unsigned long *)(val & ~OBJ_ALLOCATED_TAG);
+		if (!trypin_handle(handle))
+			return -EBUSY;
+
+		didx = obj_alloc(dst, handle);
+		copy_object(src, idx, buf, 1);
+		copy_object(dst, didx, buf, 0);
+		obj_free(src, idx);
+
+		*handle = obj_location(dst, didx) | (1UL << HANDLE_PIN_BIT);
+		unpin_handle(handle);
+	}
+
+	return 0;
+}
+
+/*
+ * Empties the sparsest zspages of @class into the fullest ones, stopping
+ * once @max_zspages have been released.  Returns the no. of zspages
+ * released.
+ */
+static unsigned long compact_class(struct zs_pool *pool,
+				struct size_class *class,
+				unsigned long max_zspages)
+{
+	int ret;
+	unsigned long freed = 0;
+	struct list_head *list;
+	struct zspage *src, *dst;
+
+	spin_lock(&class->lock);
+	while (freed < max_zspages && zs_can_compact(class)) {
+		list = &class->fullness_list[ZS_ALMOST_EMPTY];
+		if (list_empty(list))
+			list = &class->fullness_list[ZS_ALMOST_FULL];
+		if (list_empty(list))
+			break;
+		src = list_entry(list->prev, struct zspage, list);
+
+		dst = NULL;
+		list = &class->fullness_list[ZS_ALMOST_FULL];
+		if (!list_empty(list))
+			dst = list_first_entry(list, struct zspage, list);
+		if (!dst || dst == src) {
+			list = &class->fullness_list[ZS_ALMOST_EMPTY];
+			dst = NULL;
+			if (!list_empty(list))
+				dst = list_first_entry(list, struct zspage, list);
+		}
+		if (!dst || dst == src)
+			break;
+
+		ret = migrate_zspage(pool, class, src, dst);
+		fix_fullness_group(class, dst);
+		if (fix_fullness_group(class, src) == ZS_EMPTY) {
+			list_del(&src->list);
+			class->zspages--;
+			spin_unlock(&class->lock);
+
+			atomic_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+			free_zspage(src);
+			freed++;
+			cond_resched();
+
+			spin_lock(&class->lock);
+		}
+		if (ret)
+			break;
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Release sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * Moves unpinned objects out of partially used zspages into other
+ * zspages of the same size class, freeing the pages left empty.  The
+ * handles of moved objects stay valid.  May sleep.
+ *
+ * Returns the no. of pages released.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+	struct size_class *class;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+		pages += compact_class(pool, class, ULONG_MAX) *
+						class->pages_per_zspage;
+	}
+
+	return pages;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/*
+ * Lets memory pressure compact the pool without anyone asking.  The
+ * shrinker's objects are pool pages: each call releases at most
+ * nr_to_scan of them, resuming at the size class where the previous call
+ * stopped, and reports how many compaction could still release.
+ */
+static int zs_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	int i, next;
+	unsigned long freed, pages = 0;
+	unsigned long budget = sc->nr_to_scan;
+	struct size_class *class;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+						shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES && budget; i++) {
+		next = ACCESS_ONCE(pool->shrink_next);
+		pool->shrink_next = (next + 1) % ZS_SIZE_CLASSES;
+		class = &pool->size_class[next];
+
+		freed = compact_class(pool, class,
+			DIV_ROUND_UP(budget, class->pages_per_zspage)) *
+						class->pages_per_zspage;
+		budget -= min(freed, budget);
+	}
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+		pages += zs_can_compact(class) * class->pages_per_zspage;
+	}
+
+	return min_t(unsigned long, pages, INT_MAX);
+}
+
+static void free_map_areas(struct zs_pool *pool)
+{
+	int cpu;
+
+	if (!pool->map_area)
+		return;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+	free_percpu(pool->map_area);
+}
+
+/*
+ * Create a memory pool.  @name names the slab cache for handles and must
+ * remain valid until the pool is destroyed.
+ */
+struct zs_pool *zs_create_pool(const char *name)
+{
+	int i, fg, cpu;
+	struct zs_pool *pool;
+	struct size_class *class;
+	struct zs_map_area *area;
+
+	pool = vzalloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / class->size;
+	}
+
+	pool->handle_cachep = kmem_cache_create(name, sizeof(unsigned long),
+						0, 0, NULL);
+	if (!pool->handle_cachep)
+		goto fail;
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto fail;
+	for_each_possible_cpu(cpu) {
+		area = per_cpu_ptr(pool->map_area, cpu);
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	pool->shrinker.shrink = zs_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+
+fail:
+	free_map_areas(pool);
+	if (pool->handle_cachep)
+		kmem_cache_destroy(pool->handle_cachep);
+	vfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/* All objects must have been freed */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, fg;
+	struct size_class *class;
+
+	unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		class = &pool->size_class[i];
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (!list_empty(&class->fullness_list[fg]))
+				pr_info("Freeing non-empty class: %d, "
+					"fullness: %d\n", class->size, fg);
+		}
+	}
+
+	free_map_areas(pool);
+	kmem_cache_destroy(pool->handle_cachep);
+	vfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
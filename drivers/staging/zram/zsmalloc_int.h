@@ -0,0 +1,123 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "zsmalloc.h"
+
+/* User configurable params */
+
+/*
+ * Objects of one size class are carved out of a "zspage": a group of up
+ * to ZS_MAX_PAGES_PER_ZSPAGE (not necessarily contiguous) pages that is
+ * treated as one linear area, so objects may straddle a page boundary.
+ */
+#define ZS_MAX_ZSPAGE_ORDER	2
+#define ZS_MAX_PAGES_PER_ZSPAGE	(1 << ZS_MAX_ZSPAGE_ORDER)
+
+/* Must be a power of two and large enough to hold the object header */
+#define ZS_MIN_ALLOC_SHIFT	5
+#define ZS_MIN_ALLOC_SIZE	(1 << ZS_MIN_ALLOC_SHIFT)
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes.  This must be
+ * a multiple of sizeof(unsigned long) so that object headers never
+ * straddle a page boundary.
+ */
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+				/ ZS_SIZE_CLASS_DELTA + 1)
+
+/* zspages less than this fraction (in 1/4ths) full are "almost empty" */
+#define ZS_ALMOST_FULL_QUARTERS	3
+
+/* End of user params */
+
+/*
+ * Every object starts with a header word.  For an allocated object it
+ * holds the address of the object's handle, tagged with
+ * OBJ_ALLOCATED_TAG; for a free object the index of the next free object
+ * in the zspage, shifted by OBJ_TAG_BITS.
+ */
+#define ZS_HEADER_SIZE		sizeof(unsigned long)
+#define OBJ_ALLOCATED_TAG	1UL
+#define OBJ_TAG_BITS		1
+
+/*
+ * A handle points at a word holding the current location of the object,
+ * <pfn of first zspage page, object index>, shifted by HANDLE_TAG_BITS.
+ * Bit HANDLE_PIN_BIT is a bit spinlock that keeps the object from being
+ * moved by compaction.  One extra index bit is reserved for OBJ_END.
+ */
+#define OBJ_INDEX_BITS		(ZS_MAX_ZSPAGE_ORDER + PAGE_SHIFT - \
+				ZS_MIN_ALLOC_SHIFT + 1)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+#define OBJ_END			OBJ_INDEX_MASK
+#define HANDLE_PIN_BIT		0
+#define HANDLE_TAG_BITS		1
+
+enum fullness_group {
+	ZS_EMPTY,
+	ZS_ALMOST_EMPTY,
+	ZS_ALMOST_FULL,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+};
+
+struct size_class;
+
+struct zspage {
+	struct list_head list;		/* on class->fullness_list[fullness] */
+	struct size_class *class;
+	unsigned int inuse;		/* no. of allocated objects */
+	unsigned int freeobj;		/* first free object, or OBJ_END */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* object size, header included */
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+
+	/* Protected by lock */
+	unsigned long zspages;		/* no. of zspages in this class */
+	unsigned long inuse;		/* no. of allocated objects */
+};
+
+/* Per-cpu state for an object mapped with zs_map_object() */
+struct zs_map_area {
+	char *buf;			/* bounce buffer for split objects */
+	void *kaddr;			/* kmap address, NULL if bounced */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	struct kmem_cache *handle_cachep;
+	struct zs_map_area __percpu *map_area;
+	struct shrinker shrinker;
+	int shrink_next;		/* size class zs_shrink() resumes at */
+	atomic_t pages_allocated;
+};
+
+#endif
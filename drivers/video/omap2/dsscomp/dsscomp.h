@@ -114,6 +114,11 @@ struct dsscomp_data {
 	void *extra_cb_data;
 	bool must_apply;	/* whether composition must be applied */
 
+	struct list_head q;	/* link on the manager's apply queue */
+	ktime_t target;		/* do not program before this time */
+	ktime_t submitted;	/* time the composition was queued */
+	ktime_t displayed;	/* time the composition was first displayed */
+
 #ifdef CONFIG_DEBUG_FS
 	struct list_head dbg_q;
 	u32 dbg_used;
@@ -170,6 +175,7 @@ void dump_total_comp_info(struct dsscomp_dev *cdev,
 const char *dsscomp_get_color_name(enum omap_color_mode m);
 
 void dsscomp_dbg_comps(struct seq_file *s);
+void dsscomp_dbg_latency(struct seq_file *s);
 void dsscomp_dbg_gralloc(struct seq_file *s);
 
 /*
@@ -24,6 +24,7 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/ratelimit.h>
+#include <linux/math64.h>
 
 #include <video/omapdss.h>
 #include <video/dsscomp.h>
@@ -44,13 +45,32 @@ struct maskref {
 
 static struct {
 	struct workqueue_struct *apply_workq;
+	struct work_struct apply_work;	/* programs compositions from apply_q */
+	struct list_head apply_q;	/* compositions waiting to be applied */
 
 	u32 ovl_mask;		/* overlays used on this display */
 	struct maskref ovl_qmask;		/* overlays queued to this display */
 	bool blanking;
+
+	/* vsync pacing */
+	u32 vsync_irq;		/* registered vsync interrupt (0 if none) */
+	bool busy;		/* a composition was programmed for next vsync */
+	bool vsynced;		/* vsync happened since last programming */
+	ktime_t vsync;		/* time of last vsync */
+	ktime_t period;		/* measured vsync period */
+
+	/* submit-to-display latency */
+	struct {
+		u32 frames;	/* displayed compositions */
+		u32 dropped;	/* compositions superseded before vsync */
+		u64 total_us;
+		u32 max_us;
+		u32 last_us;
+	} lat;
 } mgrq[MAX_MANAGERS];
 
 static struct workqueue_struct *cb_wkq;		/* callback work queue */
+static bool exiting;				/* stop pacing on exit */
 static struct dsscomp_dev *cdev;
 
 #ifdef CONFIG_DEBUG_FS
@@ -105,14 +125,10 @@ struct dsscomp_cb_work {
 	int status;
 };
 
-struct dsscomp_apply_work {
-	struct work_struct work;
-	dsscomp_t comp;
-};
-
 /* Local caches */
 static struct kmem_cache *dsscomp_cb_wk_cachep;
-static struct kmem_cache *dsscomp_app_wk_cachep;
+
+static void dsscomp_do_apply(struct work_struct *work);
 
 /* Initialize queue structures, and set up state of the displays */
 int dsscomp_queue_init(struct dsscomp_dev *cdev_)
@@ -129,6 +145,8 @@ int dsscomp_queue_init(struct dsscomp_dev *cdev_)
 		mgrq[i].apply_workq = create_singlethread_workqueue("dsscomp_apply");
 		if (!mgrq[i].apply_workq)
 			goto error;
+		INIT_WORK(&mgrq[i].apply_work, dsscomp_do_apply);
+		INIT_LIST_HEAD(&mgrq[i].apply_q);
 
 		/* record overlays on this display */
 		mgr = cdev->mgrs[i];
@@ -159,19 +177,6 @@ int dsscomp_queue_init(struct dsscomp_dev *cdev_)
 		}
 	}
 
-	/* create cache for dsscomp_apply_work structures */
-	if (!dsscomp_app_wk_cachep) {
-		dsscomp_app_wk_cachep = kmem_cache_create("app_wk_cache",
-					sizeof(struct dsscomp_apply_work), 0,
-						SLAB_HWCACHE_ALIGN, NULL);
-		if (!dsscomp_app_wk_cachep) {
-			pr_err("DSSCOMP: %s: can't create cache\n", __func__);
-			/* destroy previously created cache */
-			kmem_cache_destroy(dsscomp_cb_wk_cachep);
-			goto error;
-		}
-	}
-
 	return 0;
 error:
 	while (i--)
@@ -449,6 +454,18 @@ static void dsscomp_mgr_delayed_cb(struct work_struct *work)
 		/* composition is 1st displayed */
 		comp->state = DSSCOMP_STATE_DISPLAYED;
 		log_state(comp, dsscomp_mgr_delayed_cb, status);
+
+		/* account submit-to-display latency */
+		if (comp->submitted.tv64) {
+			u32 us = ktime_to_us(ktime_sub(comp->displayed,
+							comp->submitted));
+			mgrq[ix].lat.frames++;
+			mgrq[ix].lat.total_us += us;
+			mgrq[ix].lat.last_us = us;
+			if (us > mgrq[ix].lat.max_us)
+				mgrq[ix].lat.max_us = us;
+		}
+
 		if (debug & DEBUG_PHASES)
 			dev_info(DEV(cdev), "[%p] displayed\n", comp);
 	} else if (status & DSS_COMPLETION_RELEASED) {
@@ -471,6 +488,10 @@ u32 dsscomp_mgr_callback(void *data, int id, int status)
 	    (status & DSS_COMPLETION_RELEASED)) {
 		struct dsscomp_cb_work *wk;
 
+		/* note the time of the vsync that displayed the composition */
+		if (status == DSS_COMPLETION_DISPLAYED)
+			comp->displayed = ktime_get();
+
 		/* allocate work object from cache */
 		wk = kmem_cache_zalloc(dsscomp_cb_wk_cachep, GFP_ATOMIC);
 		if (!wk) {
@@ -497,9 +518,9 @@ static inline bool dssdev_manually_updated(struct omap_dss_device *dev)
 		dev->driver->get_update_mode(dev) != OMAP_DSS_UPDATE_AUTO;
 }
 
-/* apply composition */
+/* apply composition, optionally waiting for the next vsync */
 /* at this point the composition is not on any queue */
-int dsscomp_apply(dsscomp_t comp)
+static int __dsscomp_apply(dsscomp_t comp, bool wait)
 {
 	int i, r = -EFAULT;
 	u32 dmask, display_ix;
@@ -804,7 +825,7 @@ skip_ovl_set:
 				 */
 				r = 0;
 			}
-		} else
+		} else if (wait)
 			/* wait for sync to do smooth animations */
 			mgr->wait_for_vsync(mgr);
 	}
@@ -812,6 +833,11 @@ skip_ovl_set:
 done:
 	return r;
 }
+
+int dsscomp_apply(dsscomp_t comp)
+{
+	return __dsscomp_apply(comp, true);
+}
 EXPORT_SYMBOL(dsscomp_apply);
 
 int dsscomp_state_notifier(struct notifier_block *nb,
@@ -829,45 +855,237 @@ int dsscomp_state_notifier(struct notifier_block *nb,
 			mgrq[mgr->id].blanking = false;
 		}
 		mutex_unlock(&mtx);
+
+		/* no more vsyncs will come - flush pending compositions */
+		if (state == OMAP_DSS_DISPLAY_DISABLED)
+			queue_work(mgrq[mgr->id].apply_workq,
+						&mgrq[mgr->id].apply_work);
 	}
 	return 0;
 }
 
-static void dsscomp_do_apply(struct work_struct *work)
+/*
+ * ===========================================================================
+ *		APPLY QUEUE
+ * ===========================================================================
+ */
+
+/*
+ * Compositions are queued per manager and programmed by the manager's apply
+ * work.  On auto-updated displays at most one composition is programmed per
+ * vsync: the vsync interrupt only kicks the apply work, as programming the
+ * DSS may sleep.  Compositions that became due before the next vsync and
+ * are superseded by a later due composition are merged into it and released
+ * without being programmed.  Other displays get every composition applied in
+ * order as soon as it is queued.
+ */
+
+/* whether compositions on this display are programmed once per vsync */
+static bool dsscomp_paced(dsscomp_t comp)
 {
-	struct dsscomp_apply_work *wk = container_of(work, typeof(*wk), work);
-	/* complete compositions that failed to apply */
-	if (dsscomp_apply(wk->comp))
-		dsscomp_mgr_callback(wk->comp, -1, DSS_COMPLETION_ECLIPSED_SET);
-	kmem_cache_free(dsscomp_app_wk_cachep, wk);
+	struct omap_dss_device *dssdev;
+	u32 display_ix = comp->frm.mgr.ix;
+
+	/* compositions are not programmed while blanking, so do not wait */
+	if (exiting || mgrq[comp->ix].blanking ||
+	    display_ix >= cdev->num_displays)
+		return false;
+	dssdev = cdev->displays[display_ix];
+
+	return dssdev && dssdev->driver && dssdev->manager &&
+		dssdev->state == OMAP_DSS_DISPLAY_ACTIVE &&
+		(comp->frm.mode & DSSCOMP_SETUP_MODE_DISPLAY) &&
+		!dssdev_manually_updated(dssdev);
 }
 
-int dsscomp_delayed_apply(dsscomp_t comp)
+/* whether composition should be programmed for the next vsync */
+static bool dsscomp_due(dsscomp_t comp, ktime_t now)
 {
-	/* don't block in case we are called from interrupt context */
-	struct dsscomp_apply_work *wk;
+	return ktime_to_us(ktime_sub(comp->target, now)) <
+		ktime_to_us(mgrq[comp->ix].period);
+}
 
-	/* allocate work object from cache */
-	wk = kmem_cache_zalloc(dsscomp_app_wk_cachep, GFP_NOWAIT);
-	if (!wk) {
-		pr_warn("DSSCOMP: %s: can't allocate object from cache\n",
-								__func__);
-		return -ENOMEM;
+/*
+ * Merge a superseded composition into the one queued after it.  This is only
+ * possible if the newer composition sets all overlays that the older one
+ * enables, so that no buffer of the older composition remains on screen.
+ * Overlays disabled by the older composition are carried over.
+ */
+static bool dsscomp_merge(dsscomp_t old, dsscomp_t new)
+{
+	u32 oix, carry = 0;
+
+	/* mtx is locked */
+	if (old->frm.mode != new->frm.mode ||
+	    old->frm.mgr.ix != new->frm.mgr.ix ||
+	    ((old->ovl_mask | new->ovl_mask) & (1 << OMAP_DSS_WB)))
+		return false;
+
+	for (oix = 0; oix < old->frm.num_ovls; oix++) {
+		struct dss2_ovl_info *oi = old->ovls + oix;
+
+		if (new->ovl_mask & (1 << oi->cfg.ix))
+			continue;
+		if (oi->cfg.enabled)
+			return false;
+		carry |= 1 << oi->cfg.ix;
+	}
+
+	if (new->frm.num_ovls + hweight32(carry) > ARRAY_SIZE(new->ovls))
+		return false;
+
+	for (oix = 0; oix < old->frm.num_ovls; oix++) {
+		struct dss2_ovl_info *oi = old->ovls + oix;
+
+		if (!(carry & (1 << oi->cfg.ix)))
+			continue;
+		new->ovls[new->frm.num_ovls++] = *oi;
+		new->ovl_mask |= 1 << oi->cfg.ix;
+		maskref_incbit(&mgrq[new->ix].ovl_qmask, oi->cfg.ix);
 	}
+	new->must_apply |= old->must_apply;
+
+	return true;
+}
+
+static void dsscomp_vsync_isr(void *data, u32 mask)
+{
+	typeof(mgrq[0]) *q = data;
+	ktime_t now = ktime_get();
+
+	if (q->vsync.tv64)
+		q->period = ktime_sub(now, q->vsync);
+	q->vsync = now;
+	q->vsynced = true;
+	queue_work(q->apply_workq, &q->apply_work);
+}
+
+/* enable vsync interrupts for a display */
+static void dsscomp_vsync_enable(u32 ix, struct omap_dss_device *dssdev)
+{
+	u32 irq;
+
+	/* mtx is locked */
+	if (mgrq[ix].vsync_irq)
+		return;
+
+	if (dssdev->manager->id == OMAP_DSS_CHANNEL_DIGIT)
+		irq = dssdev->type == OMAP_DISPLAY_TYPE_VENC ?
+				DISPC_IRQ_EVSYNC_ODD : DISPC_IRQ_EVSYNC_EVEN;
+	else
+		irq = dssdev->manager->id == OMAP_DSS_CHANNEL_LCD2 ?
+				DISPC_IRQ_VSYNC2 : DISPC_IRQ_VSYNC;
+
+	if (omap_dispc_register_isr(dsscomp_vsync_isr, mgrq + ix, irq))
+		dev_err(DEV(cdev), "failed to register vsync isr\n");
+	else
+		mgrq[ix].vsync_irq = irq;
+}
+
+/* disable vsync interrupts for a display */
+static void dsscomp_vsync_disable(u32 ix)
+{
+	/* mtx is locked */
+	if (!mgrq[ix].vsync_irq)
+		return;
+
+	omap_dispc_unregister_isr(dsscomp_vsync_isr, mgrq + ix,
+							mgrq[ix].vsync_irq);
+	mgrq[ix].vsync_irq = 0;
+	mgrq[ix].vsync.tv64 = 0;
+	mgrq[ix].period.tv64 = 0;
+}
+
+static void dsscomp_do_apply(struct work_struct *work)
+{
+	typeof(mgrq[0]) *q = container_of(work, typeof(*q), apply_work);
+	dsscomp_t comp, next, c, c_;
+	LIST_HEAD(eclipsed);
+	bool paced;
+	ktime_t now;
 
+	mutex_lock(&mtx);
+	while (!list_empty(&q->apply_q)) {
+		comp = list_first_entry(&q->apply_q, typeof(*comp), q);
+		paced = dsscomp_paced(comp);
+
+		if (paced) {
+			/* program only one composition per vsync */
+			dsscomp_vsync_enable(comp->ix,
+					cdev->displays[comp->frm.mgr.ix]);
+			now = ktime_get();
+			if ((q->busy && !q->vsynced) || !dsscomp_due(comp, now))
+				break;
+
+			/* skip compositions superseded before the vsync */
+			while (!list_is_last(&comp->q, &q->apply_q)) {
+				next = list_entry(comp->q.next, typeof(*next), q);
+				if (!dsscomp_paced(next) || !dsscomp_due(next, now) ||
+				    !dsscomp_merge(comp, next))
+					break;
+				list_move_tail(&comp->q, &eclipsed);
+				q->lat.dropped++;
+				comp = next;
+			}
+
+			q->busy = true;
+			q->vsynced = false;
+		}
+		list_del(&comp->q);
+		mutex_unlock(&mtx);
+
+		/* release superseded compositions */
+		list_for_each_entry_safe(c, c_, &eclipsed, q) {
+			list_del(&c->q);
+			log_state(c, dsscomp_do_apply,
+						DSS_COMPLETION_ECLIPSED_SET);
+			dsscomp_mgr_callback(c, -1, DSS_COMPLETION_ECLIPSED_SET);
+		}
+
+		/* complete compositions that failed to apply */
+		if (__dsscomp_apply(comp, !paced))
+			dsscomp_mgr_callback(comp, -1,
+						DSS_COMPLETION_ECLIPSED_SET);
+
+		mutex_lock(&mtx);
+	}
+
+	/* stop vsync interrupts after a vsync with nothing to program */
+	if (list_empty(&q->apply_q) && (!q->busy || q->vsynced)) {
+		q->busy = false;
+		dsscomp_vsync_disable(q - mgrq);
+	}
+	mutex_unlock(&mtx);
+}
+
+/*
+ * Queue a composition to be programmed for the first vsync at or after
+ * target.  A zero target means the next vsync.
+ */
+int dsscomp_queue_apply(dsscomp_t comp, ktime_t target)
+{
 	mutex_lock(&mtx);
 
 	BUG_ON(comp->state != DSSCOMP_STATE_ACTIVE);
 	comp->state = DSSCOMP_STATE_APPLYING;
-	log_state(comp, dsscomp_delayed_apply, 0);
+	comp->target = target;
+	comp->submitted = ktime_get();
+	log_state(comp, dsscomp_queue_apply, 0);
 
 	if (debug & DEBUG_PHASES)
 		dev_info(DEV(cdev), "[%p] applying\n", comp);
+
+	list_add_tail(&comp->q, &mgrq[comp->ix].apply_q);
 	mutex_unlock(&mtx);
 
-	wk->comp = comp;
-	INIT_WORK(&wk->work, dsscomp_do_apply);
-	return queue_work(mgrq[comp->ix].apply_workq, &wk->work) ? 0 : -EBUSY;
+	queue_work(mgrq[comp->ix].apply_workq, &mgrq[comp->ix].apply_work);
+	return 0;
+}
+EXPORT_SYMBOL(dsscomp_queue_apply);
+
+int dsscomp_delayed_apply(dsscomp_t comp)
+{
+	return dsscomp_queue_apply(comp, ktime_set(0, 0));
 }
 EXPORT_SYMBOL(dsscomp_delayed_apply);
 
@@ -950,6 +1168,26 @@ void dsscomp_dbg_comps(struct seq_file *s)
 #endif
 }
 
+void dsscomp_dbg_latency(struct seq_file *s)
+{
+#ifdef CONFIG_DEBUG_FS
+	u32 i;
+
+	mutex_lock(&mtx);
+	for (i = 0; i < cdev->num_mgrs; i++) {
+		typeof(mgrq[0].lat) *l = &mgrq[i].lat;
+
+		seq_printf(s, "%s: frames=%u dropped=%u vsync=%lldus\n",
+			   cdev->mgrs[i]->name, l->frames, l->dropped,
+			   ktime_to_us(mgrq[i].period));
+		seq_printf(s, "  latency(us) avg=%u last=%u max=%u\n",
+			   l->frames ? (u32) div_u64(l->total_us, l->frames) : 0,
+			   l->last_us, l->max_us);
+	}
+	mutex_unlock(&mtx);
+#endif
+}
+
 void dsscomp_dbg_events(struct seq_file *s)
 {
 #ifdef CONFIG_DSSCOMP_DEBUG_LOG
@@ -981,6 +1219,12 @@ void dsscomp_queue_exit(void)
 {
 	if (cdev) {
 		int i;
+		/* apply pending compositions without waiting for vsyncs */
+		mutex_lock(&mtx);
+		exiting = true;
+		for (i = 0; i < cdev->num_mgrs; i++)
+			dsscomp_vsync_disable(i);
+		mutex_unlock(&mtx);
 		for (i = 0; i < cdev->num_displays; i++)
 			destroy_workqueue(mgrq[i].apply_workq);
 		destroy_workqueue(cb_wkq);
@@ -18,6 +18,7 @@
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
 #include <linux/list.h>
+#include <linux/ktime.h>
 #endif
 
 /* The early_suspend structure defines suspend and resume hooks to be called
@@ -35,12 +36,22 @@ enum {
 	EARLY_SUSPEND_LEVEL_STOP_DRAWING = 100,
 	EARLY_SUSPEND_LEVEL_DISABLE_FB = 150,
 };
+/* Handlers of a lower level are suspended before, and resumed after, those
+ * of a higher level.  Handlers of the same level may run concurrently
+ * when the earlysuspend.parallel parameter is set.
+ */
 struct early_suspend {
 #ifdef CONFIG_HAS_EARLYSUSPEND
 	struct list_head link;
 	int level;
 	void (*suspend)(struct early_suspend *h);
 	void (*resume)(struct early_suspend *h);
+	struct {
+		ktime_t suspend_time;
+		ktime_t max_suspend_time;
+		ktime_t resume_time;
+		ktime_t max_resume_time;
+	} stat;
 #endif
 };
 
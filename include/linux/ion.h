@@ -63,6 +63,10 @@ struct ion_buffer;
  * @name:	used for debug purposes
  * @base:	base address of heap in physical memory if applicable
  * @size:	size of the heap in bytes if applicable
+ * @movable:	for a carveout, lend the memory to movable allocations while
+ *		it is not used by the heap (needs CONFIG_CMA, and @base and
+ *		@size aligned to a pageblock).  The board must memblock_reserve
+ *		rather than remove such a carveout.
  *
  * Provided by the board file.
  */
@@ -72,6 +76,7 @@ struct ion_platform_heap {
 	const char *name;
 	ion_phys_addr_t base;
 	size_t size;
+	bool movable;
 };
 
 /**
@@ -342,6 +347,47 @@ struct ion_cached_user_buf_data {
 	size_t size;
 };
 
+/**
+ * enum ion_cache_op - cache maintenance to do on a range of a buffer
+ * @ION_CACHE_CLEAN:		write dirty lines back, before the device reads
+ * @ION_CACHE_INVALIDATE:	drop lines, before the cpu reads what the
+ *				device wrote
+ * @ION_CACHE_FLUSH:		clean and invalidate
+ */
+enum ion_cache_op {
+	ION_CACHE_CLEAN = 0,
+	ION_CACHE_INVALIDATE = 1,
+	ION_CACHE_FLUSH = 2,
+};
+
+/**
+ * struct ion_cache_op_data - one range to maintain in an ION_IOC_CACHE_OPS
+ * @handle:	a handle
+ * @vaddr:	virtual address the handle is mapped cachable at
+ * @offset:	offset of the range in the buffer
+ * @len:	length of the range
+ * @op:		an enum ion_cache_op
+ */
+struct ion_cache_op_data {
+	struct ion_handle *handle;
+	unsigned long vaddr;
+	size_t offset;
+	size_t len;
+	unsigned int op;
+};
+
+#define ION_CACHE_OPS_MAX	64
+
+/**
+ * struct ion_cache_ops_data - a vector of ranges to maintain
+ * @ops:	array of @count struct ion_cache_op_data
+ * @count:	number of ranges, at most ION_CACHE_OPS_MAX
+ */
+struct ion_cache_ops_data {
+	struct ion_cache_op_data *ops;
+	unsigned int count;
+};
+
 /**
  * struct ion_map_gralloc_to_ionhandle_data
  */
@@ -412,4 +458,16 @@ struct ion_map_gralloc_to_ionhandle_data {
 #define ION_IOC_INVAL_CACHED		_IOWR(ION_IOC_MAGIC, 9, struct ion_cached_user_buf_data)
 #define ION_IOC_MAP_GRALLOC	        _IOWR(ION_IOC_MAGIC, 10, \
 				struct ion_map_gralloc_to_ionhandle_data)
+
+/**
+ * DOC: ION_IOC_CACHE_OPS - clean, invalidate or flush ranges of buffers
+ *
+ * Takes an ion_cache_ops_data struct pointing at an array of ranges of
+ * buffers mapped cachable.  All ranges are checked before any maintenance is
+ * done.  When they add up to more than the cost of maintaining a whole cache
+ * the kernel does that once instead, for the cpu and the outer cache
+ * separately.
+ */
+#define ION_IOC_CACHE_OPS	_IOWR(ION_IOC_MAGIC, 11, \
+				struct ion_cache_ops_data)
 #endif /* _LINUX_ION_H */
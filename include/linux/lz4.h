@@ -0,0 +1,33 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *  Compressor and safe decompressor for the LZ4 block format
+ *
+ *  LZ4 trades some compression ratio for much cheaper decompression
+ *  than LZO: a block is a plain sequence of literal runs and
+ *  <offset, length> back-references, with no bit-level coding.
+ *
+ *  Format defined by Yann Collet, see http://code.google.com/p/lz4/
+ */
+
+#define LZ4_MEM_COMPRESS	(4096 * sizeof(u32))
+
+#define lz4_compressbound(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * This requires 'wrkmem' of size LZ4_MEM_COMPRESS and 'dst' of at
+ * least lz4_compressbound(src_len) bytes.  Returns 0 on success.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression: never reads beyond 'src + src_len' nor writes
+ * beyond 'dst + *dst_len'.  On success returns 0 and sets *dst_len
+ * to the decompressed size, on malformed input returns a negative value.
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src,
+		size_t src_len, unsigned char *dst, size_t *dst_len);
+
+#endif
@@ -1280,6 +1280,10 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct list_head lowmem_entry;	/* lowmemorykiller oom_adj bucket */
+	int lowmem_bucket;		/* index of that bucket */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
@@ -1756,6 +1760,9 @@ extern void thread_group_times(struct task_struct *p, cputime_t *ut, cputime_t *
 
 extern int task_free_register(struct notifier_block *n);
 extern int task_free_unregister(struct notifier_block *n);
+extern int task_leader_register(struct notifier_block *n);
+extern int task_leader_unregister(struct notifier_block *n);
+extern void task_leader_notify(struct task_struct *tsk);
 
 /*
  * Per process flags
@@ -158,6 +158,12 @@ static struct kmem_cache *mm_cachep;
 /* Notifier list called when a task struct is freed */
 static ATOMIC_NOTIFIER_HEAD(task_free_notifier);
 
+/*
+ * Notifier list called, with tasklist_lock held for writing, when a task
+ * becomes a thread group leader by fork or by exec from a sub-thread.
+ */
+static ATOMIC_NOTIFIER_HEAD(task_leader_notifier);
+
 static void account_kernel_stack(struct thread_info *ti, int account)
 {
 	struct zone *zone = page_zone(virt_to_page(ti));
@@ -201,6 +207,23 @@ int task_free_unregister(struct notifier_block *n)
 }
 EXPORT_SYMBOL(task_free_unregister);
 
+int task_leader_register(struct notifier_block *n)
+{
+	return atomic_notifier_chain_register(&task_leader_notifier, n);
+}
+EXPORT_SYMBOL_GPL(task_leader_register);
+
+int task_leader_unregister(struct notifier_block *n)
+{
+	return atomic_notifier_chain_unregister(&task_leader_notifier, n);
+}
+EXPORT_SYMBOL_GPL(task_leader_unregister);
+
+void task_leader_notify(struct task_struct *tsk)
+{
+	atomic_notifier_call_chain(&task_leader_notifier, 0, tsk);
+}
+
 void __put_task_struct(struct task_struct *tsk)
 {
 	WARN_ON(!tsk->exit_state);
@@ -1150,6 +1173,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	delayacct_tsk_init(p);	/* Must remain after dup_task_struct() */
 	copy_flags(clone_flags, p);
 	INIT_LIST_HEAD(&p->children);
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	INIT_LIST_HEAD(&p->lowmem_entry);
+#endif
 	INIT_LIST_HEAD(&p->sibling);
 	rcu_copy_process(p);
 	p->vfork_done = NULL;
@@ -1372,6 +1398,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 			list_add_tail(&p->sibling, &p->real_parent->children);
 			list_add_tail_rcu(&p->tasks, &init_task.tasks);
 			__this_cpu_inc(process_counts);
+			task_leader_notify(p);
 		}
 		attach_pid(p, PIDTYPE_PID, pid);
 		nr_threads++;
@@ -13,10 +13,13 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -32,6 +35,13 @@ enum {
 static int debug_mask = DEBUG_USER_STATE | DEBUG_SUSPEND | DEBUG_VERBOSE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/*
+ * run the handlers of a level concurrently; off by default as existing
+ * handlers may rely on the registration order within a level
+ */
+static int parallel;
+module_param_named(parallel, parallel, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
 static void early_suspend(struct work_struct *work);
@@ -46,6 +56,93 @@ enum {
 };
 static int state;
 
+static LIST_HEAD(early_suspend_domain);
+static ktime_t early_suspend_time;
+static ktime_t late_resume_time;
+
+static void call_handler(struct early_suspend *handler, bool resume)
+{
+	void (*func)(struct early_suspend *h);
+	char symname[KSYM_NAME_LEN];
+	ktime_t start, duration;
+
+	func = resume ? handler->resume : handler->suspend;
+	if (debug_mask & DEBUG_VERBOSE) {
+		lookup_symbol_name((unsigned long)func, symname);
+		pr_info("%s: %s\n", resume ? "late_resume" : "early_suspend",
+			symname);
+	}
+
+	start = ktime_get();
+	func(handler);
+	duration = ktime_sub(ktime_get(), start);
+
+	if (resume) {
+		handler->stat.resume_time = duration;
+		if (duration.tv64 > handler->stat.max_resume_time.tv64)
+			handler->stat.max_resume_time = duration;
+	} else {
+		handler->stat.suspend_time = duration;
+		if (duration.tv64 > handler->stat.max_suspend_time.tv64)
+			handler->stat.max_suspend_time = duration;
+	}
+}
+
+static void early_suspend_async(void *data, async_cookie_t cookie)
+{
+	call_handler(data, false);
+}
+
+static void late_resume_async(void *data, async_cookie_t cookie)
+{
+	call_handler(data, true);
+}
+
+/*
+ * call_handlers - call every suspend, or in reverse every resume, handler.
+ * The handlers of a level are started together on early_suspend_domain and
+ * the next level waits for all of them to return.  A handler alone in its
+ * level is simply called.
+ *
+ * Caller must hold early_suspend_lock.
+ */
+static ktime_t call_handlers(bool resume)
+{
+	struct list_head *head = &early_suspend_handlers;
+	struct list_head *p, *next;
+	struct early_suspend *pos;
+	int level = 0;
+	bool scheduled = false;
+	ktime_t start = ktime_get();
+
+	for (p = resume ? head->prev : head->next; p != head; p = next) {
+		next = resume ? p->prev : p->next;
+		pos = list_entry(p, struct early_suspend, link);
+		if (!(resume ? pos->resume : pos->suspend))
+			continue;
+
+		if (scheduled && pos->level != level) {
+			async_synchronize_full_domain(&early_suspend_domain);
+			scheduled = false;
+		}
+		level = pos->level;
+
+		if (parallel && (scheduled || (next != head &&
+		    list_entry(next, struct early_suspend, link)->level ==
+		    level))) {
+			async_schedule_domain(resume ? late_resume_async :
+					      early_suspend_async, pos,
+					      &early_suspend_domain);
+			scheduled = true;
+		} else {
+			call_handler(pos, resume);
+		}
+	}
+	async_synchronize_full_domain(&early_suspend_domain);
+
+	return ktime_sub(ktime_get(), start);
+}
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
@@ -59,7 +156,7 @@ void register_early_suspend(struct early_suspend *handler)
 	}
 	list_add_tail(&handler->link, pos);
 	if ((state & SUSPENDED) && handler->suspend)
-		handler->suspend(handler);
+		call_handler(handler, false);
 	mutex_unlock(&early_suspend_lock);
 }
 EXPORT_SYMBOL(register_early_suspend);
@@ -74,10 +171,8 @@ EXPORT_SYMBOL(unregister_early_suspend);
 
 static void early_suspend(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
-	char symname[KSYM_NAME_LEN];
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -96,17 +191,7 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
-	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL) {
-			if (debug_mask & DEBUG_VERBOSE) {
-				lookup_symbol_name(
-					(unsigned long)pos->suspend, symname);
-				pr_info("early_suspend: %s\n", symname);
-			}
-
-			pos->suspend(pos);
-		}
-	}
+	early_suspend_time = call_handlers(false);
 	mutex_unlock(&early_suspend_lock);
 
 	/*run sys_sync workqueue*/
@@ -124,10 +209,8 @@ abort:
 
 static void late_resume(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
-	char symname[KSYM_NAME_LEN];
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -144,19 +227,10 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link) {
-		if (pos->resume != NULL) {
-			if (debug_mask & DEBUG_VERBOSE) {
-				lookup_symbol_name(
-					(unsigned long)pos->resume, symname);
-				pr_info("late_resume: %s\n", symname);
-			}
-
-			pos->resume(pos);
-		}
-	}
+	late_resume_time = call_handlers(true);
 	if (debug_mask & DEBUG_SUSPEND)
-		pr_info("late_resume: done\n");
+		pr_info("late_resume: done in %lld us\n",
+			ktime_to_us(late_resume_time));
 abort:
 	mutex_unlock(&early_suspend_lock);
 }
@@ -197,3 +271,54 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_debug_show(struct seq_file *s, void *data)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(s, "early_suspend %lld us, late_resume %lld us\n\n",
+		   ktime_to_us(early_suspend_time),
+		   ktime_to_us(late_resume_time));
+	seq_printf(s, "level  suspend_us  max_us  resume_us  max_us  handler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(s, "%5d  %10lld  %6lld  %9lld  %6lld  %pf\n",
+			   pos->level, ktime_to_us(pos->stat.suspend_time),
+			   ktime_to_us(pos->stat.max_suspend_time),
+			   ktime_to_us(pos->stat.resume_time),
+			   ktime_to_us(pos->stat.max_resume_time),
+			   pos->suspend ? (void *)pos->suspend :
+					  (void *)pos->resume);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_debug_show, NULL);
+}
+
+static const struct file_operations early_suspend_debug_fops = {
+	.open		= early_suspend_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init early_suspend_debug_init(void)
+{
+	struct dentry *d;
+
+	d = debugfs_create_file("early_suspend", S_IRUGO, NULL, NULL,
+		&early_suspend_debug_fops);
+	if (!d) {
+		pr_err("Failed to create early_suspend debug file\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+late_initcall(early_suspend_debug_init);
+#endif
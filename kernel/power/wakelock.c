@@ -38,11 +38,19 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define WAKE_LOCK_INITIALIZED            (1U << 8)
 #define WAKE_LOCK_ACTIVE                 (1U << 9)
 #define WAKE_LOCK_AUTO_EXPIRE            (1U << 10)
-#define WAKE_LOCK_PREVENTING_SUSPEND     (1U << 11)
 
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+/*
+ * Active locks are also indexed, so that deciding whether to suspend does
+ * not walk them: those without a timeout are only counted, those with one
+ * are kept in a tree ordered by expiry with its first and last cached.
+ */
+static int active_untimed_locks[WAKE_LOCK_TYPE_COUNT];
+static struct rb_root expire_tree[WAKE_LOCK_TYPE_COUNT];
+static struct rb_node *expire_first[WAKE_LOCK_TYPE_COUNT];
+static struct rb_node *expire_last[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 static int suspend_sys_sync_count;
 static DEFINE_SPINLOCK(suspend_sys_sync_lock);
@@ -59,10 +67,19 @@ static struct wake_lock suspend_backoff_lock;
 
 static unsigned suspend_short_count;
 
+static void expire_wake_locks_locked(int type);
+
 #ifdef CONFIG_WAKELOCK_STAT
 static struct wake_lock deleted_wake_locks;
 static ktime_t last_sleep_time_update;
 static int wait_for_wakeup;
+/*
+ * Total time spent waiting to suspend, i.e. with main_wake_lock released,
+ * up to last_sleep_time_update.  A suspend lock is charged the growth of
+ * this clock while it is active as its prevent_suspend_time.
+ */
+static ktime_t sleep_wait_time;
+static bool sleep_waiting;
 
 int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 {
@@ -87,6 +104,33 @@ int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 }
 
 
+/* sleep_wait_time_at - the sleep wait clock at 'time', not before the last
+ * update of it.
+ */
+static ktime_t sleep_wait_time_at(ktime_t time)
+{
+	if (!sleep_waiting || time.tv64 < last_sleep_time_update.tv64)
+		return sleep_wait_time;
+	return ktime_add(sleep_wait_time,
+			 ktime_sub(time, last_sleep_time_update));
+}
+
+/* sleep_wait_since - the time 'lock' prevented suspend from its last
+ * activation up to 'time'.
+ */
+static ktime_t sleep_wait_since(struct wake_lock *lock, ktime_t time)
+{
+	if ((lock->flags & WAKE_LOCK_TYPE_MASK) != WAKE_LOCK_SUSPEND)
+		return ktime_set(0, 0);
+	return ktime_sub(sleep_wait_time_at(time), lock->stat.sleep_wait_start);
+}
+
+static void wake_lock_stat_start_locked(struct wake_lock *lock)
+{
+	lock->stat.last_time = ktime_get();
+	lock->stat.sleep_wait_start = sleep_wait_time_at(lock->stat.last_time);
+}
+
 static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 {
 	int lock_count = lock->stat.count;
@@ -108,9 +152,8 @@ static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 		else
 			expire_count++;
 		total_time = ktime_add(total_time, add_time);
-		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)
-			prevent_suspend_time = ktime_add(prevent_suspend_time,
-					ktime_sub(now, last_sleep_time_update));
+		prevent_suspend_time = ktime_add(prevent_suspend_time,
+				sleep_wait_since(lock, now));
 		if (add_time.tv64 > max_time.tv64)
 			max_time = add_time;
 	}
@@ -163,47 +206,96 @@ static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 	if (ktime_to_ns(duration) > ktime_to_ns(lock->stat.max_time))
 		lock->stat.max_time = duration;
 	lock->stat.last_time = ktime_get();
-	if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-		duration = ktime_sub(now, last_sleep_time_update);
-		lock->stat.prevent_suspend_time = ktime_add(
-			lock->stat.prevent_suspend_time, duration);
-		lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
-	}
+	lock->stat.prevent_suspend_time = ktime_add(
+		lock->stat.prevent_suspend_time, sleep_wait_since(lock, now));
 }
 
 static void update_sleep_wait_stats_locked(int done)
 {
-	struct wake_lock *lock;
-	ktime_t now, etime, elapsed, add;
-	int expired;
+	ktime_t now;
+
+	/* charge expired locks up to their expiry, under the old state */
+	expire_wake_locks_locked(WAKE_LOCK_SUSPEND);
 
 	now = ktime_get();
-	elapsed = ktime_sub(now, last_sleep_time_update);
-	list_for_each_entry(lock, &active_wake_locks[WAKE_LOCK_SUSPEND], link) {
-		expired = get_expired_time(lock, &etime);
-		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-			if (expired)
-				add = ktime_sub(etime, last_sleep_time_update);
-			else
-				add = elapsed;
-			lock->stat.prevent_suspend_time = ktime_add(
-				lock->stat.prevent_suspend_time, add);
-		}
-		if (done || expired)
-			lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
-		else
-			lock->flags |= WAKE_LOCK_PREVENTING_SUSPEND;
-	}
+	sleep_wait_time = sleep_wait_time_at(now);
+	sleep_waiting = !done;
 	last_sleep_time_update = now;
 }
 #endif
 
 
+/* Caller must acquire the list_lock spinlock */
+static void expire_tree_insert(int type, struct wake_lock *lock)
+{
+	struct rb_node **p = &expire_tree[type].rb_node;
+	struct rb_node *parent = NULL;
+	bool first = true, last = true;
+
+	while (*p) {
+		parent = *p;
+		if (time_before(lock->expires, rb_entry(parent,
+				struct wake_lock, expire_node)->expires)) {
+			p = &parent->rb_left;
+			last = false;
+		} else {
+			p = &parent->rb_right;
+			first = false;
+		}
+	}
+	rb_link_node(&lock->expire_node, parent, p);
+	rb_insert_color(&lock->expire_node, &expire_tree[type]);
+
+	if (first)
+		expire_first[type] = &lock->expire_node;
+	if (last)
+		expire_last[type] = &lock->expire_node;
+}
+
+/* Caller must acquire the list_lock spinlock */
+static void expire_tree_erase(int type, struct wake_lock *lock)
+{
+	if (expire_first[type] == &lock->expire_node)
+		expire_first[type] = rb_next(&lock->expire_node);
+	if (expire_last[type] == &lock->expire_node)
+		expire_last[type] = rb_prev(&lock->expire_node);
+	rb_erase(&lock->expire_node, &expire_tree[type]);
+}
+
+/* add_active_lock - index 'lock' after it was made active
+ * Caller must acquire the list_lock spinlock
+ */
+static void add_active_lock(struct wake_lock *lock)
+{
+	int type = lock->flags & WAKE_LOCK_TYPE_MASK;
+
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		expire_tree_insert(type, lock);
+	else
+		active_untimed_locks[type]++;
+}
+
+/* remove_active_lock - drop 'lock' from the index, if active
+ * Caller must acquire the list_lock spinlock
+ */
+static void remove_active_lock(struct wake_lock *lock)
+{
+	int type = lock->flags & WAKE_LOCK_TYPE_MASK;
+
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
+		return;
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		expire_tree_erase(type, lock);
+	else
+		active_untimed_locks[type]--;
+}
+
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	remove_active_lock(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -234,23 +326,32 @@ static void print_active_locks(int type)
 	}
 }
 
+/* Caller must acquire the list_lock spinlock */
+static void expire_wake_locks_locked(int type)
+{
+	struct wake_lock *lock;
+
+	while (expire_first[type]) {
+		lock = rb_entry(expire_first[type], struct wake_lock,
+				expire_node);
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		expire_wake_lock(lock);
+	}
+}
+
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct wake_lock *lock;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
-	}
-	return max_timeout;
+	expire_wake_locks_locked(type);
+	if (active_untimed_locks[type])
+		return -1;
+	if (!expire_last[type])
+		return 0;
+	lock = rb_entry(expire_last[type], struct wake_lock, expire_node);
+	return lock->expires - jiffies;
 }
 
 long has_wake_lock(int type)
@@ -507,6 +608,7 @@ void wake_lock_destroy(struct wake_lock *lock)
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
 	spin_lock_irqsave(&list_lock, irqflags);
+	remove_active_lock(lock);
 	lock->flags &= ~WAKE_LOCK_INITIALIZED;
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
@@ -549,13 +651,14 @@ static void wake_lock_internal(
 	if ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) &&
 	    (long)(lock->expires - jiffies) <= 0) {
 		wake_unlock_stat_locked(lock, 0);
-		lock->stat.last_time = ktime_get();
+		wake_lock_stat_start_locked(lock);
 	}
 #endif
+	remove_active_lock(lock);
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
-		lock->stat.last_time = ktime_get();
+		wake_lock_stat_start_locked(lock);
 #endif
 	}
 	list_del(&lock->link);
@@ -574,6 +677,7 @@ static void wake_lock_internal(
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
 		list_add(&lock->link, &active_wake_locks[type]);
 	}
+	add_active_lock(lock);
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
 #ifdef CONFIG_WAKELOCK_STAT
@@ -626,6 +730,7 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	remove_active_lock(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -680,8 +785,10 @@ static int __init wakelocks_init(void)
 	int ret;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
+	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++) {
 		INIT_LIST_HEAD(&active_wake_locks[i]);
+		expire_tree[i] = RB_ROOT;
+	}
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
@@ -0,0 +1,134 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Format defined by Yann Collet, see http://code.google.com/p/lz4/
+ *
+ *  Single pass compressor with a 4096 entry hash table of the last
+ *  position each 4 byte sequence was seen at.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static unsigned char *lz4_write_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+
+	return op;
+}
+
+static unsigned char *lz4_write_literals(unsigned char *op,
+		unsigned char *token, const unsigned char *anchor, size_t len)
+{
+	if (len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_write_length(op, len - RUN_MASK);
+	} else {
+		*token = len << ML_BITS;
+	}
+	memcpy(op, anchor, len);
+
+	return op + len;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src, *anchor = src, *ref;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst, *token;
+	unsigned int attempts;
+	size_t len;
+	u32 seq, h;
+
+	if (src_len < MINLENGTH)
+		goto last_literals;
+
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+
+	for (;;) {
+		/* Find a 4 byte match within MAX_DISTANCE */
+		attempts = 1 << SKIP_STRENGTH;
+		for (;;) {
+			if (unlikely(ip > mflimit))
+				goto last_literals;
+			seq = LZ4_READ32(ip);
+			h = lz4_hash(seq);
+			ref = src + hash_table[h];
+			hash_table[h] = ip - src;
+			if (ref < ip && ip - ref <= MAX_DISTANCE &&
+					LZ4_READ32(ref) == seq)
+				break;
+			ip += attempts++ >> SKIP_STRENGTH;
+		}
+
+		/* Extend it backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		token = op++;
+		op = lz4_write_literals(op, token, anchor, ip - anchor);
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* Extend it forwards, a word at a time */
+		ip += MINMATCH;
+		ref += MINMATCH;
+		anchor = ip;
+		while (ip < matchlimit - (sizeof(long) - 1)) {
+			unsigned long diff = LZ4_READLONG(ref) ^
+						LZ4_READLONG(ip);
+
+			if (diff) {
+				ip += lz4_nb_common_bytes(diff);
+				goto count_done;
+			}
+			ip += sizeof(long);
+			ref += sizeof(long);
+		}
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+count_done:
+		len = ip - anchor;
+		if (len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_write_length(op, len - ML_MASK);
+		} else {
+			*token |= len;
+		}
+
+		anchor = ip;
+		if (ip > mflimit)
+			break;
+
+		/* The match was skipped over; remember a position inside it */
+		hash_table[lz4_hash(LZ4_READ32(ip - 2))] = ip - 2 - src;
+	}
+
+last_literals:
+	token = op++;
+	op = lz4_write_literals(op, token, anchor, iend - anchor);
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
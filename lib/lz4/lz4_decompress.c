@@ -0,0 +1,100 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Format defined by Yann Collet, see http://code.google.com/p/lz4/
+ *
+ *  Every length and offset read from the input is checked against both
+ *  buffers, so corrupted input fails cleanly instead of overrunning.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/string.h>
+#include <linux/types.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static int lz4_read_length(const unsigned char **ip,
+		const unsigned char *iend, size_t *len)
+{
+	unsigned int s;
+
+	do {
+		if (unlikely(*ip >= iend))
+			return -1;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+
+	return 0;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src,
+		size_t src_len, unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src, *ref;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char * const oend = dst + *dst_len;
+	unsigned int token;
+	size_t len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* Literal run */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && lz4_read_length(&ip, iend, &len))
+			goto malformed;
+		if (unlikely(len > (size_t)(iend - ip) ||
+				len > (size_t)(oend - op)))
+			goto malformed;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence has no match */
+		if (ip == iend)
+			break;
+
+		/* Back-reference */
+		if (unlikely(iend - ip < 2))
+			goto malformed;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > (size_t)(op - dst)))
+			goto malformed;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && lz4_read_length(&ip, iend, &len))
+			goto malformed;
+		len += MINMATCH;
+		if (unlikely(len > (size_t)(oend - op)))
+			goto malformed;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* Overlapping copy repeats the last offset bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return 0;
+
+malformed:
+	return -1;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants and helpers
+ *
+ *  Format defined by Yann Collet, see http://code.google.com/p/lz4/
+ */
+
+#include <linux/bitops.h>
+#include <asm/unaligned.h>
+
+/*
+ * A sequence is a token byte, optional literal length bytes, the literals,
+ * a little-endian 16 bit match offset and optional match length bytes.
+ * The token holds the literal run length in its high nibble and the match
+ * length minus MINMATCH in its low nibble; a nibble of 15 means that
+ * bytes follow, each adding its value, until one is less than 255.
+ * The last sequence of a block stops after its literals.
+ */
+#define MINMATCH	4
+#define COPYLENGTH	8
+#define LASTLITERALS	5
+#define MFLIMIT		(COPYLENGTH + MINMATCH)
+#define MINLENGTH	(MFLIMIT + 1)
+
+#define MAXD_LOG	16
+#define MAX_DISTANCE	((1 << MAXD_LOG) - 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define HASH_LOG	12
+#define HASHTABLESIZE	(1 << HASH_LOG)
+
+/*
+ * How quickly the compressor skips ahead through data that does not
+ * match: after 2^SKIP_STRENGTH failed probes the step grows by one byte.
+ */
+#define SKIP_STRENGTH	6
+
+#define LZ4_READ32(p)	get_unaligned((const u32 *)(p))
+#define LZ4_READLONG(p)	get_unaligned((const unsigned long *)(p))
+
+static inline u32 lz4_hash(u32 seq)
+{
+	return (seq * 2654435761U) >> (MINMATCH * 8 - HASH_LOG);
+}
+
+/* No. of identical leading bytes given the XOR of two words */
+static inline unsigned int lz4_nb_common_bytes(unsigned long diff)
+{
+#ifdef __LITTLE_ENDIAN
+	return __ffs(diff) >> 3;
+#else
+	return (BITS_PER_LONG - 1 - __fls(diff)) >> 3;
+#endif
+}